@@ -1,136 +1,4355 @@
 #define _USE_MATH_DEFINES
 #include <SDL3/SDL.h>
+#include <SDL3/SDL_intrin.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
-#define MAX_BALLS 500
+// The kernel sets, worker counts and fixed/float paths promise bit-identical
+// results, which fused multiply-adds would break (-march=native lets the
+// compiler fuse mul + add, vector intrinsics included). Contraction is off for
+// the whole file whatever the build flags; -ffast-math and /fp:fast reorder
+// arithmetic beyond this and are not supported.
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#elif defined(_MSC_VER)
+#pragma fp_contract(off)
+#endif
+
 int WINDOW_WIDTH = 1200;
 int WINDOW_HEIGHT = 900;
 
-typedef struct {
-    float x, y;
-} vec;
+typedef struct {
+    float x, y;
+} vec;
+
+vec v_add(vec a, vec b){
+    return (vec){a.x + b.x, a.y + b.y};
+}
+
+vec v_sub(vec a, vec b){
+    return (vec){a.x - b.x, a.y - b.y};
+}
+
+vec v_mul(vec a, float b){
+    return (vec){a.x * b, a.y * b};
+}
+
+float v_dot(vec a, vec b){
+    return (float)(a.x * b.x + a.y * b.y);
+}
+
+float v_len2(vec a){
+    return v_dot(a, a);
+}
+
+// Ball state is kept as a structure of arrays so that each loop streams only
+// the fields it touches. The ball_* accessors give the vec view used by the
+// collision helpers.
+typedef struct {
+    float *x, *y;
+    float *vx, *vy;
+    float *radius;
+    float *mass;
+    float *inv_mass;
+} BallArrays;
+
+BallArrays balls;
+int ball_count = 0;
+int ball_capacity = 0;
+
+#define CACHE_LINE 64
+
+// Grows every ball array to hold at least capacity balls. The arrays are
+// SIMD and cache-line aligned and padded to a multiple of 16 floats so vector
+// loops can read whole registers; they only move when spawning outgrows
+// them, never during a step.
+int reserve_balls(int capacity){
+    if (capacity <= ball_capacity) return 1;
+    capacity = (capacity + 15) & ~15;
+
+    float **fields[] = {&balls.x, &balls.y, &balls.vx, &balls.vy, &balls.radius, &balls.mass, &balls.inv_mass};
+    float *grown[SDL_arraysize(fields)];
+    size_t alignment = SDL_max(SDL_GetSIMDAlignment(), CACHE_LINE);
+    for (size_t f = 0; f < SDL_arraysize(fields); f++){
+        grown[f] = SDL_aligned_alloc(alignment, capacity * sizeof(float));
+        if (grown[f] == NULL){
+            while (f > 0) SDL_aligned_free(grown[--f]);
+            SDL_Log("Could not grow ball storage to %d balls", capacity);
+            return 0;
+        }
+    }
+    for (size_t f = 0; f < SDL_arraysize(fields); f++){
+        if (ball_count > 0) memcpy(grown[f], *fields[f], ball_count * sizeof(float));
+        SDL_aligned_free(*fields[f]);
+        *fields[f] = grown[f];
+    }
+    ball_capacity = capacity;
+    return 1;
+}
+
+vec ball_position(int i){
+    return (vec){balls.x[i], balls.y[i]};
+}
+
+vec ball_velocity(int i){
+    return (vec){balls.vx[i], balls.vy[i]};
+}
+
+void set_ball_position(int i, vec position){
+    balls.x[i] = position.x;
+    balls.y[i] = position.y;
+}
+
+void set_ball_velocity(int i, vec velocity){
+    balls.vx[i] = velocity.x;
+    balls.vy[i] = velocity.y;
+}
+// Bumped whenever balls are added or removed so persistent broadphase state
+// knows its ball indices are stale.
+int ball_generation = 0;
+
+// Set while every ball has the same radius (mass), so update_balls can use the
+// kernels specialised for that; never set without balls. spawn_ball clears
+// them as soon as a ball differs and removing balls rescans.
+int uniform_radius = 0;
+int uniform_mass = 0;
+
+void refresh_uniformity(void){
+    uniform_radius = uniform_mass = ball_count > 0;
+    for (int i = 1; i < ball_count; i++){
+        if (balls.radius[i] != balls.radius[0]) uniform_radius = 0;
+        if (balls.mass[i] != balls.mass[0]) uniform_mass = 0;
+    }
+}
+
+// Spawned radii are drawn uniformly from this range; P toggles a wide
+// polydisperse range.
+float spawn_radius_min = 25.0f;
+float spawn_radius_max = 25.0f;
+
+void spawn_ball(float x, float y){
+    if (ball_count == ball_capacity && !reserve_balls(ball_capacity ? ball_capacity * 2 : 1024)) return;
+
+    balls.x[ball_count] = x;
+    balls.y[ball_count] = y;
+
+    balls.vx[ball_count] =  ((rand() % 3) * 2 - 1) * 10;
+    balls.vy[ball_count] =  ((rand() % 3) * 2 - 1) * 10;
+
+    balls.radius[ball_count] = spawn_radius_min + (spawn_radius_max - spawn_radius_min) * ((float)rand() / (float)RAND_MAX);
+    balls.mass[ball_count] = fabs((rand() % 3) * 2 - 1);
+    balls.inv_mass[ball_count] = 1.0f / balls.mass[ball_count];
+    if (ball_count == 0) uniform_radius = uniform_mass = 1;
+    if (balls.radius[ball_count] != balls.radius[0]) uniform_radius = 0;
+    if (balls.mass[ball_count] != balls.mass[0]) uniform_mass = 0;
+    ball_count++;
+    ball_generation++;
+}
+
+// Worker pool for the parallel phases of a step. Every worker owns a
+// Chase-Lev deque: it pushes and pops tasks at the bottom, and idle workers
+// steal from the top. The thread calling into the pool is worker 0 and runs
+// tasks while it waits. Idle workers spin for a while, then sleep on a
+// condition until more work is pushed.
+#define POOL_MAX_WORKERS 64
+#define POOL_DEQUE_SIZE 1024
+#define POOL_SPIN_ROUNDS 2000
+
+typedef void (*TaskFn)(void *data, int begin, int end, int worker);
+
+typedef struct {
+    SDL_AtomicInt pending;
+} TaskGroup;
+
+typedef struct {
+    TaskFn fn;
+    void *data;
+    int begin, end;
+    TaskGroup *group;
+} Task;
+
+// top and bottom only grow; differences are taken in unsigned arithmetic so
+// they stay right when the counters wrap.
+typedef struct {
+    SDL_AtomicInt top;
+    char pad_top[CACHE_LINE - sizeof(SDL_AtomicInt)];
+    SDL_AtomicInt bottom;
+    char pad_bottom[CACHE_LINE - sizeof(SDL_AtomicInt)];
+    Task tasks[POOL_DEQUE_SIZE];
+} WorkDeque;
+
+typedef struct {
+    WorkDeque *deques;
+    SDL_Thread *threads[POOL_MAX_WORKERS];
+    int worker_count;
+    SDL_AtomicInt epoch;
+    SDL_AtomicInt sleeping;
+    SDL_AtomicInt quit;
+    SDL_Mutex *lock;
+    SDL_Condition *wake;
+} WorkerPool;
+
+WorkerPool pool = {.worker_count = 1};
+
+// Owner only. Fails when the deque is full; the caller then runs the task.
+int deque_push(WorkDeque *d, const Task *task){
+    int b = SDL_GetAtomicInt(&d->bottom);
+    if ((unsigned)b - (unsigned)SDL_GetAtomicInt(&d->top) >= POOL_DEQUE_SIZE) return 0;
+    d->tasks[b & (POOL_DEQUE_SIZE - 1)] = *task;
+    SDL_MemoryBarrierRelease();
+    SDL_SetAtomicInt(&d->bottom, (int)((unsigned)b + 1));
+    return 1;
+}
+
+// Owner only. Takes the newest task; the last one is raced for with thieves.
+// The decrement is an atomic add for its full barrier: thieves must see the
+// new bottom before the owner reads top.
+int deque_pop(WorkDeque *d, Task *task){
+    int b = (int)((unsigned)SDL_AddAtomicInt(&d->bottom, -1) - 1);
+    int t = SDL_GetAtomicInt(&d->top);
+    int size = (int)((unsigned)b - (unsigned)t);
+    if (size < 0){
+        SDL_SetAtomicInt(&d->bottom, t);
+        return 0;
+    }
+
+    *task = d->tasks[b & (POOL_DEQUE_SIZE - 1)];
+    if (size > 0) return 1;
+    int won = SDL_CompareAndSwapAtomicInt(&d->top, t, (int)((unsigned)t + 1));
+    SDL_SetAtomicInt(&d->bottom, (int)((unsigned)t + 1));
+    return won;
+}
+
+// Any thread. Takes the oldest task; fails if the deque is empty or another
+// thread took it first.
+int deque_steal(WorkDeque *d, Task *task){
+    int t = SDL_GetAtomicInt(&d->top);
+    SDL_MemoryBarrierAcquire();
+    int b = SDL_GetAtomicInt(&d->bottom);
+    if ((int)((unsigned)b - (unsigned)t) <= 0) return 0;
+
+    *task = d->tasks[t & (POOL_DEQUE_SIZE - 1)];
+    return SDL_CompareAndSwapAtomicInt(&d->top, t, (int)((unsigned)t + 1));
+}
+
+int pool_find_task(int worker, Task *task){
+    if (deque_pop(&pool.deques[worker], task)) return 1;
+    for (int n = 1; n < pool.worker_count; n++){
+        int victim = (worker + n) % pool.worker_count;
+        if (deque_steal(&pool.deques[victim], task)) return 1;
+    }
+    return 0;
+}
+
+void pool_run_task(const Task *task, int worker){
+    task->fn(task->data, task->begin, task->end, worker);
+    SDL_AddAtomicInt(&task->group->pending, -1);
+}
+
+// Bumping the epoch before reading the sleeper count pairs with a sleeper
+// counting itself before re-reading the epoch, so a push never misses one.
+void pool_notify(void){
+    SDL_AddAtomicInt(&pool.epoch, 1);
+    if (SDL_GetAtomicInt(&pool.sleeping) == 0) return;
+    SDL_LockMutex(pool.lock);
+    SDL_BroadcastCondition(pool.wake);
+    SDL_UnlockMutex(pool.lock);
+}
+
+int pool_worker_main(void *data){
+    int worker = (int)(intptr_t)data;
+    Task task;
+    while (!SDL_GetAtomicInt(&pool.quit)){
+        int seen = SDL_GetAtomicInt(&pool.epoch);
+        int found = 0;
+        for (int spin = 0; spin < POOL_SPIN_ROUNDS && !found; spin++){
+            found = pool_find_task(worker, &task);
+            if (!found) SDL_CPUPauseInstruction();
+        }
+        if (found){
+            pool_run_task(&task, worker);
+            continue;
+        }
+
+        SDL_LockMutex(pool.lock);
+        SDL_AddAtomicInt(&pool.sleeping, 1);
+        while (!SDL_GetAtomicInt(&pool.quit) && SDL_GetAtomicInt(&pool.epoch) == seen) SDL_WaitCondition(pool.wake, pool.lock);
+        SDL_AddAtomicInt(&pool.sleeping, -1);
+        SDL_UnlockMutex(pool.lock);
+    }
+    return 0;
+}
+
+void pool_stop(void){
+    if (pool.worker_count <= 1) return;
+    SDL_SetAtomicInt(&pool.quit, 1);
+    SDL_LockMutex(pool.lock);
+    SDL_BroadcastCondition(pool.wake);
+    SDL_UnlockMutex(pool.lock);
+    for (int w = 1; w < pool.worker_count; w++){
+        if (pool.threads[w]) SDL_WaitThread(pool.threads[w], NULL);
+    }
+    SDL_DestroyCondition(pool.wake);
+    SDL_DestroyMutex(pool.lock);
+    SDL_aligned_free(pool.deques);
+    pool.deques = NULL;
+    pool.worker_count = 1;
+}
+
+// Restarts the pool with worker_count workers including the caller; 0 means
+// one per logical core. With one worker everything runs inline.
+void pool_start(int worker_count){
+    pool_stop();
+    if (worker_count <= 0) worker_count = SDL_GetNumLogicalCPUCores();
+    if (worker_count > POOL_MAX_WORKERS) worker_count = POOL_MAX_WORKERS;
+    if (worker_count <= 1) return;
+
+    pool.deques = SDL_aligned_alloc(CACHE_LINE, worker_count * sizeof(WorkDeque));
+    pool.lock = SDL_CreateMutex();
+    pool.wake = SDL_CreateCondition();
+    if (!pool.deques || !pool.lock || !pool.wake){
+        SDL_Log("Could not create the worker pool: %s", SDL_GetError());
+        if (pool.wake) SDL_DestroyCondition(pool.wake);
+        if (pool.lock) SDL_DestroyMutex(pool.lock);
+        SDL_aligned_free(pool.deques);
+        pool.deques = NULL;
+        return;
+    }
+    for (int w = 0; w < worker_count; w++){
+        SDL_SetAtomicInt(&pool.deques[w].top, 0);
+        SDL_SetAtomicInt(&pool.deques[w].bottom, 0);
+    }
+    SDL_SetAtomicInt(&pool.quit, 0);
+    SDL_SetAtomicInt(&pool.sleeping, 0);
+
+    // Set before any worker runs, as workers read it. A worker that fails to
+    // start leaves an empty deque behind, which costs only a failed steal.
+    pool.worker_count = worker_count;
+    for (int w = 1; w < worker_count; w++){
+        pool.threads[w] = SDL_CreateThread(pool_worker_main, "physics worker", (void *)(intptr_t)w);
+        if (pool.threads[w] == NULL) SDL_Log("Could not start worker %d: %s", w, SDL_GetError());
+    }
+}
+
+void task_group_init(TaskGroup *g){
+    SDL_SetAtomicInt(&g->pending, 0);
+}
+
+// Queues fn over [begin, end) on worker's deque, where worker is the calling
+// worker (0 outside tasks).
+void task_group_push(TaskGroup *g, int worker, TaskFn fn, void *data, int begin, int end){
+    Task task = {fn, data, begin, end, g};
+    SDL_AddAtomicInt(&g->pending, 1);
+    if (pool.worker_count <= 1 || !deque_push(&pool.deques[worker], &task)) pool_run_task(&task, worker);
+}
+
+void task_group_run(TaskGroup *g, int worker, TaskFn fn, void *data, int begin, int end){
+    task_group_push(g, worker, fn, data, begin, end);
+    if (pool.worker_count > 1) pool_notify();
+}
+
+// Runs queued tasks, this group's or any other, until the group is done.
+void task_group_wait(TaskGroup *g, int worker){
+    Task task;
+    while (SDL_GetAtomicInt(&g->pending) > 0){
+        if (pool_find_task(worker, &task)) pool_run_task(&task, worker);
+        else SDL_CPUPauseInstruction();
+    }
+}
+
+// Splits [0, count) into chunks of grain items and runs them on the pool,
+// returning when all are done. Chunk boundaries depend only on count and
+// grain, never on the worker count.
+void parallel_for(TaskFn fn, void *data, int count, int grain){
+    if (grain < 1) grain = 1;
+    if (pool.worker_count <= 1 || count <= grain){
+        for (int begin = 0; begin < count; begin += grain){
+            fn(data, begin, begin + grain < count ? begin + grain : count, 0);
+        }
+        return;
+    }
+
+    // Workers are woken with every chunk rather than once at the end: they
+    // start stealing while the rest is queued, and once the deque is full and
+    // the caller runs chunks itself they are already awake to share them.
+    // pool_notify is one atomic add while nobody sleeps.
+    TaskGroup group;
+    task_group_init(&group);
+    for (int begin = 0; begin < count; begin += grain){
+        task_group_push(&group, 0, fn, data, begin, begin + grain < count ? begin + grain : count);
+        pool_notify();
+    }
+    task_group_wait(&group, 0);
+}
+
+typedef enum {
+    BROADPHASE_BRUTE,
+    BROADPHASE_GRID,
+    BROADPHASE_SAP,
+    BROADPHASE_TREE,
+    BROADPHASE_HGRID,
+    BROADPHASE_VERLET,
+    BROADPHASE_INCREMENTAL_GRID,
+    BROADPHASE_COUNT,
+    BROADPHASE_AUTO = BROADPHASE_COUNT
+} BroadphaseMode;
+
+// The selected mode may be BROADPHASE_AUTO; the active one is the back-end
+// that actually runs.
+BroadphaseMode broadphase_mode = BROADPHASE_GRID;
+BroadphaseMode broadphase_active = BROADPHASE_GRID;
+int broadphase_pair_tests = 0;
+
+typedef struct {
+    int *a;
+    int *b;
+    int count;
+    int capacity;
+} PairList;
+
+PairList pairs;
+
+void pairs_push(PairList *list, int a, int b){
+    if (list->count == list->capacity){
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        list->a = realloc(list->a, list->capacity * sizeof(int));
+        list->b = realloc(list->b, list->capacity * sizeof(int));
+    }
+    list->a[list->count] = a;
+    list->b[list->count] = b;
+    list->count++;
+}
+
+// Box test with both boxes grown by margin / 2, so balls up to margin apart pass.
+int aabb_overlap_within(int i, int j, float margin){
+    broadphase_pair_tests++;
+    float reach = balls.radius[i] + balls.radius[j] + margin;
+    return fabsf(balls.x[j] - balls.x[i]) < reach &&
+           fabsf(balls.y[j] - balls.y[i]) < reach;
+}
+
+int aabb_overlap(int i, int j){
+    return aabb_overlap_within(i, j, 0.0f);
+}
+
+void find_pairs_brute(PairList *out){
+    for (int i = 0; i < ball_count; i++){
+        for (int j = i + 1; j < ball_count; j++){
+            if (aabb_overlap(i, j)) pairs_push(out, i, j);
+        }
+    }
+}
+
+#define GRID_MAX_CELLS (1 << 22)
+
+// Uniform grid over the window. Cells are at least one diameter wide so every
+// contact is between balls in the same or adjacent cells.
+typedef struct {
+    float cell_size;
+    float inv_cell_size;
+    int cols, rows;
+    int *cell_start;
+    int *cell_balls;
+    int *ball_cell;     // cell of each inserted ball, in insertion order
+    int cell_capacity;
+    int ball_capacity;
+} Grid;
+
+Grid grid;
+
+float max_ball_radius(void){
+    float max_radius = 0.0f;
+    for (int i = 0; i < ball_count; i++){
+        if (balls.radius[i] > max_radius) max_radius = balls.radius[i];
+    }
+    return max_radius;
+}
+
+float min_ball_radius(void){
+    float min_radius = ball_count ? balls.radius[0] : 0.0f;
+    for (int i = 1; i < ball_count; i++){
+        if (balls.radius[i] < min_radius) min_radius = balls.radius[i];
+    }
+    return min_radius;
+}
+
+int grid_coord(float v, float inv_cell_size, int limit){
+    int c = (int)(v * inv_cell_size);
+    if (v < 0.0f || c < 0) return 0;
+    if (c >= limit) return limit - 1;
+    return c;
+}
+
+float grid_fit_cell_size(float cell_size, float width, float height){
+    if (cell_size < 1.0f) cell_size = 1.0f;
+    while ((width / cell_size + 1.0f) * (height / cell_size + 1.0f) > GRID_MAX_CELLS) cell_size *= 2.0f;
+    return cell_size;
+}
+
+void grid_reserve(Grid *g, int member_count){
+    int cell_count = g->cols * g->rows;
+    if (cell_count + 1 > g->cell_capacity){
+        g->cell_capacity = cell_count + 1;
+        g->cell_start = realloc(g->cell_start, g->cell_capacity * sizeof(int));
+    }
+    if (member_count > g->ball_capacity){
+        g->ball_capacity = member_count;
+        g->cell_balls = realloc(g->cell_balls, g->ball_capacity * sizeof(int));
+        g->ball_cell = realloc(g->ball_cell, g->ball_capacity * sizeof(int));
+    }
+}
+
+// Counting sort of the members by the cells already stored in ball_cell:
+// histogram, prefix sum, scatter. The sort is stable, so balls within a cell
+// stay in member order.
+void grid_sort_serial(Grid *g, const int *members, int member_count){
+    int cell_count = g->cols * g->rows;
+    memset(g->cell_start, 0, (cell_count + 1) * sizeof(int));
+    for (int k = 0; k < member_count; k++){
+        g->cell_start[g->ball_cell[k] + 1]++;
+    }
+    for (int c = 0; c < cell_count; c++){
+        g->cell_start[c + 1] += g->cell_start[c];
+    }
+    for (int k = 0; k < member_count; k++){
+        g->cell_balls[g->cell_start[g->ball_cell[k]]++] = members ? members[k] : k;
+    }
+    // The scatter advanced every start to the next cell's start; shift back.
+    for (int c = cell_count; c > 0; c--){
+        g->cell_start[c] = g->cell_start[c - 1];
+    }
+    g->cell_start[0] = 0;
+}
+
+// Fills ball_cell for members [begin, end).
+typedef void (*GridKeyFn)(Grid *g, const int *members, int begin, int end);
+
+// Parallel version of the counting sort. The members are split into up to one
+// part per worker. Each part computes its keys (when a key function is given) and
+// counts them into its own histogram row. Then cell blocks turn the rows into
+// offsets: each cell's parts are laid out in part order, so the result is
+// the same stable order the serial sort gives. A scan of the block sums and
+// a per-part scatter finish the sort.
+#define GRID_PARALLEL_MIN_BALLS 16384
+
+typedef struct {
+    Grid *g;
+    const int *members;
+    int member_count;
+    int parts;
+    int cell_count;
+    GridKeyFn keys;
+    int *counts;        // parts rows of cell_count
+    int block_base[POOL_MAX_WORKERS + 1];
+} GridSortJob;
+
+int *grid_sort_counts;
+size_t grid_sort_counts_capacity;
+
+int job_part_begin(int part, int parts, int count){
+    return (int)((Sint64)count * part / parts);
+}
+
+void grid_count_task(void *data, int part, int part_end, int worker){
+    GridSortJob *job = data;
+    (void)worker;
+    for (; part < part_end; part++){
+        int begin = job_part_begin(part, job->parts, job->member_count);
+        int end = job_part_begin(part + 1, job->parts, job->member_count);
+        int *row = job->counts + (size_t)part * job->cell_count;
+        if (job->keys) job->keys(job->g, job->members, begin, end);
+        memset(row, 0, job->cell_count * sizeof(int));
+        for (int k = begin; k < end; k++) row[job->g->ball_cell[k]]++;
+    }
+}
+
+void grid_offsets_task(void *data, int block, int block_end, int worker){
+    GridSortJob *job = data;
+    (void)worker;
+    for (; block < block_end; block++){
+        int begin = job_part_begin(block, job->parts, job->cell_count);
+        int end = job_part_begin(block + 1, job->parts, job->cell_count);
+        int local = 0;
+        for (int c = begin; c < end; c++){
+            job->g->cell_start[c] = local;
+            for (int p = 0; p < job->parts; p++){
+                int *count = job->counts + (size_t)p * job->cell_count + c;
+                int n = *count;
+                *count = local - job->g->cell_start[c];
+                local += n;
+            }
+        }
+        job->block_base[block + 1] = local;
+    }
+}
+
+void grid_rebase_task(void *data, int block, int block_end, int worker){
+    GridSortJob *job = data;
+    (void)worker;
+    for (; block < block_end; block++){
+        int begin = job_part_begin(block, job->parts, job->cell_count);
+        int end = job_part_begin(block + 1, job->parts, job->cell_count);
+        for (int c = begin; c < end; c++) job->g->cell_start[c] += job->block_base[block];
+    }
+}
+
+void grid_scatter_task(void *data, int part, int part_end, int worker){
+    GridSortJob *job = data;
+    (void)worker;
+    for (; part < part_end; part++){
+        int begin = job_part_begin(part, job->parts, job->member_count);
+        int end = job_part_begin(part + 1, job->parts, job->member_count);
+        int *row = job->counts + (size_t)part * job->cell_count;
+        for (int k = begin; k < end; k++){
+            int c = job->g->ball_cell[k];
+            job->g->cell_balls[job->g->cell_start[c] + row[c]++] = job->members ? job->members[k] : k;
+        }
+    }
+}
+
+// Sorts the members into the grid, computing their cells with keys first
+// unless keys is NULL and ball_cell is already filled. Large sorts run on the
+// pool; the result does not depend on the worker count.
+void grid_sort(Grid *g, const int *members, int member_count, GridKeyFn keys){
+    // Every part clears and scans a row of all the cells, so the parts are
+    // capped to keep their rows no larger than the members in total; a
+    // sparse scene with more cells than members sorts serially.
+    int cell_count = g->cols * g->rows;
+    int parts = SDL_min(pool.worker_count, member_count / SDL_max(cell_count, 1));
+    if (parts < 2 || member_count < GRID_PARALLEL_MIN_BALLS){
+        if (keys) keys(g, members, 0, member_count);
+        grid_sort_serial(g, members, member_count);
+        return;
+    }
+
+    GridSortJob job = {g, members, member_count, parts, cell_count, keys, NULL, {0}};
+    size_t needed = (size_t)job.parts * job.cell_count;
+    if (needed > grid_sort_counts_capacity){
+        grid_sort_counts_capacity = needed;
+        grid_sort_counts = realloc(grid_sort_counts, needed * sizeof(int));
+    }
+    job.counts = grid_sort_counts;
+
+    parallel_for(grid_count_task, &job, job.parts, 1);
+    parallel_for(grid_offsets_task, &job, job.parts, 1);
+    for (int b = 0; b < job.parts; b++) job.block_base[b + 1] += job.block_base[b];
+    parallel_for(grid_rebase_task, &job, job.parts, 1);
+    g->cell_start[job.cell_count] = member_count;
+    parallel_for(grid_scatter_task, &job, job.parts, 1);
+}
+
+void grid_cell_keys(Grid *g, const int *members, int begin, int end){
+    for (int k = begin; k < end; k++){
+        int i = members ? members[k] : k;
+        int cx = grid_coord(balls.x[i], g->inv_cell_size, g->cols);
+        int cy = grid_coord(balls.y[i], g->inv_cell_size, g->rows);
+        g->ball_cell[k] = cy * g->cols + cx;
+    }
+}
+
+// Lays the grid over the window and sorts ball indices into it. members lists
+// the balls to insert; NULL means all of them.
+void grid_build(Grid *g, float cell_size, float width, float height, const int *members, int member_count){
+    cell_size = grid_fit_cell_size(cell_size, width, height);
+
+    g->cell_size = cell_size;
+    g->inv_cell_size = 1.0f / cell_size;
+    g->cols = (int)(width * g->inv_cell_size) + 1;
+    g->rows = (int)(height * g->inv_cell_size) + 1;
+    grid_reserve(g, member_count);
+    grid_sort(g, members, member_count, grid_cell_keys);
+}
+
+// Each cell is paired with itself and its E, SW, S and SE neighbours, so every
+// neighbouring pair of cells is visited exactly once.
+void grid_find_pairs(Grid *g, PairList *out, float margin){
+    static const int offsets[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+    for (int cy = 0; cy < g->rows; cy++){
+        for (int cx = 0; cx < g->cols; cx++){
+            int c = cy * g->cols + cx;
+            int begin = g->cell_start[c];
+            int end = g->cell_start[c + 1];
+            if (begin == end) continue;
+
+            for (int k = begin; k < end; k++){
+                for (int m = k + 1; m < end; m++){
+                    if (aabb_overlap_within(g->cell_balls[k], g->cell_balls[m], margin)) pairs_push(out, g->cell_balls[k], g->cell_balls[m]);
+                }
+            }
+
+            for (int n = 0; n < 4; n++){
+                int nx = cx + offsets[n][0];
+                int ny = cy + offsets[n][1];
+                if (nx < 0 || nx >= g->cols || ny >= g->rows) continue;
+
+                int nc = ny * g->cols + nx;
+                for (int k = begin; k < end; k++){
+                    for (int m = g->cell_start[nc]; m < g->cell_start[nc + 1]; m++){
+                        if (aabb_overlap_within(g->cell_balls[k], g->cell_balls[m], margin)) pairs_push(out, g->cell_balls[k], g->cell_balls[m]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Set of unordered ball pairs: an open-addressing hash from pair key to a slot
+// in a dense key array, so the set can be walked without scanning the table.
+typedef struct {
+    Uint64 *keys;
+    int count;
+    int key_capacity;
+    Uint64 *table_keys;
+    int *table_slots;
+    int table_mask;
+} PairSet;
+
+#define PAIR_EMPTY (~(Uint64)0)
+
+Uint64 pair_key(int a, int b){
+    if (a > b){
+        int t = a;
+        a = b;
+        b = t;
+    }
+    return ((Uint64)(Uint32)a << 32) | (Uint32)b;
+}
+
+int pair_set_home(const PairSet *set, Uint64 key){
+    return (int)((key * 0x9E3779B97F4A7C15ull) >> 32) & set->table_mask;
+}
+
+void pair_set_clear(PairSet *set){
+    set->count = 0;
+    if (set->table_keys){
+        for (int t = 0; t <= set->table_mask; t++) set->table_keys[t] = PAIR_EMPTY;
+    }
+}
+
+void pair_set_insert(PairSet *set, Uint64 key);
+
+void pair_set_grow(PairSet *set){
+    int table_size = set->table_keys ? (set->table_mask + 1) * 2 : 1024;
+    free(set->table_keys);
+    free(set->table_slots);
+    set->table_keys = malloc(table_size * sizeof(Uint64));
+    set->table_slots = malloc(table_size * sizeof(int));
+    set->table_mask = table_size - 1;
+
+    int count = set->count;
+    pair_set_clear(set);
+    for (int k = 0; k < count; k++) pair_set_insert(set, set->keys[k]);
+}
+
+void pair_set_insert(PairSet *set, Uint64 key){
+    if (!set->table_keys || 2 * (set->count + 1) > set->table_mask + 1) pair_set_grow(set);
+
+    int t = pair_set_home(set, key);
+    while (set->table_keys[t] != PAIR_EMPTY){
+        if (set->table_keys[t] == key) return;
+        t = (t + 1) & set->table_mask;
+    }
+
+    if (set->count == set->key_capacity){
+        set->key_capacity = set->key_capacity ? set->key_capacity * 2 : 1024;
+        set->keys = realloc(set->keys, set->key_capacity * sizeof(Uint64));
+    }
+    set->table_keys[t] = key;
+    set->table_slots[t] = set->count;
+    set->keys[set->count++] = key;
+}
+
+int pair_set_find(const PairSet *set, Uint64 key){
+    if (!set->table_keys) return -1;
+    int t = pair_set_home(set, key);
+    while (set->table_keys[t] != PAIR_EMPTY){
+        if (set->table_keys[t] == key) return t;
+        t = (t + 1) & set->table_mask;
+    }
+    return -1;
+}
+
+void pair_set_remove(PairSet *set, Uint64 key){
+    int t = pair_set_find(set, key);
+    if (t < 0) return;
+
+    // Swap-remove from the dense array and repoint the moved key's entry.
+    int slot = set->table_slots[t];
+    Uint64 last = set->keys[--set->count];
+    if (slot != set->count){
+        set->keys[slot] = last;
+        set->table_slots[pair_set_find(set, last)] = slot;
+    }
+
+    // Backward-shift deletion keeps probe chains intact without tombstones.
+    int hole = t;
+    int next = (t + 1) & set->table_mask;
+    while (set->table_keys[next] != PAIR_EMPTY){
+        int home = pair_set_home(set, set->table_keys[next]);
+        if (((next - home) & set->table_mask) >= ((next - hole) & set->table_mask)){
+            set->table_keys[hole] = set->table_keys[next];
+            set->table_slots[hole] = set->table_slots[next];
+            hole = next;
+        }
+        next = (next + 1) & set->table_mask;
+    }
+    set->table_keys[hole] = PAIR_EMPTY;
+}
+
+// Sweep and prune over persistent per-axis endpoint lists. Endpoints are only
+// re-sorted with insertion sort, and every min/max swap adds or removes the
+// pair from the overlap set, so coherent motion costs close to O(n).
+typedef struct {
+    float value;
+    int id;             // ball index * 2, plus 1 for a max endpoint
+} Endpoint;
+
+typedef struct {
+    Endpoint *axis[2];
+    float *bounds;      // per ball: min x, max x, min y, max y
+    int capacity;
+    int ball_count;
+    int generation;
+    int valid;
+    PairSet overlaps;
+} SweepAndPrune;
+
+SweepAndPrune sap;
+
+// Touching boxes count as overlapping, so at equal values a min sorts before a max.
+int endpoint_less(Endpoint a, Endpoint b){
+    return a.value < b.value || (a.value == b.value && !(a.id & 1) && (b.id & 1));
+}
+
+int endpoint_compare(const void *a, const void *b){
+    Endpoint ea = *(const Endpoint *)a;
+    Endpoint eb = *(const Endpoint *)b;
+    return endpoint_less(ea, eb) ? -1 : endpoint_less(eb, ea) ? 1 : 0;
+}
+
+int sap_boxes_overlap(const float *bounds, int a, int b){
+    broadphase_pair_tests++;
+    const float *ba = bounds + a * 4;
+    const float *bb = bounds + b * 4;
+    return ba[0] <= bb[1] && bb[0] <= ba[1] && ba[2] <= bb[3] && bb[2] <= ba[3];
+}
+
+void sap_update_bounds(SweepAndPrune *s){
+    for (int i = 0; i < ball_count; i++){
+        float *b = s->bounds + i * 4;
+        b[0] = balls.x[i] - balls.radius[i];
+        b[1] = balls.x[i] + balls.radius[i];
+        b[2] = balls.y[i] - balls.radius[i];
+        b[3] = balls.y[i] + balls.radius[i];
+    }
+    for (int a = 0; a < 2; a++){
+        for (int k = 0; k < 2 * ball_count; k++){
+            Endpoint *e = &s->axis[a][k];
+            e->value = s->bounds[(e->id >> 1) * 4 + a * 2 + (e->id & 1)];
+        }
+    }
+}
+
+void sap_rebuild(SweepAndPrune *s){
+    if (ball_count > s->capacity){
+        s->capacity = ball_count;
+        s->axis[0] = realloc(s->axis[0], 2 * s->capacity * sizeof(Endpoint));
+        s->axis[1] = realloc(s->axis[1], 2 * s->capacity * sizeof(Endpoint));
+        s->bounds = realloc(s->bounds, 4 * s->capacity * sizeof(float));
+    }
+    for (int a = 0; a < 2; a++){
+        for (int k = 0; k < 2 * ball_count; k++) s->axis[a][k].id = k;
+    }
+    sap_update_bounds(s);
+    // with no balls the axes are still unallocated, and qsort wants a base
+    if (ball_count > 0){
+        qsort(s->axis[0], 2 * ball_count, sizeof(Endpoint), endpoint_compare);
+        qsort(s->axis[1], 2 * ball_count, sizeof(Endpoint), endpoint_compare);
+    }
+
+    // One sweep along x seeds the overlap set; later steps only patch it.
+    pair_set_clear(&s->overlaps);
+    int *active = malloc((ball_count + 1) * sizeof(int));
+    int active_count = 0;
+    for (int k = 0; k < 2 * ball_count; k++){
+        int ball = s->axis[0][k].id >> 1;
+        if (s->axis[0][k].id & 1){
+            for (int m = 0; m < active_count; m++){
+                if (active[m] == ball){
+                    active[m] = active[--active_count];
+                    break;
+                }
+            }
+        } else {
+            for (int m = 0; m < active_count; m++){
+                if (sap_boxes_overlap(s->bounds, ball, active[m])) pair_set_insert(&s->overlaps, pair_key(ball, active[m]));
+            }
+            active[active_count++] = ball;
+        }
+    }
+    free(active);
+
+    s->ball_count = ball_count;
+    s->generation = ball_generation;
+    s->valid = 1;
+}
+
+void sap_sort_axis(SweepAndPrune *s, Endpoint *list){
+    for (int k = 1; k < 2 * s->ball_count; k++){
+        Endpoint e = list[k];
+        int j = k - 1;
+        while (j >= 0 && endpoint_less(e, list[j])){
+            Endpoint other = list[j];
+            int a = e.id >> 1;
+            int b = other.id >> 1;
+            if (!(e.id & 1) && (other.id & 1)){
+                if (sap_boxes_overlap(s->bounds, a, b)) pair_set_insert(&s->overlaps, pair_key(a, b));
+            } else if ((e.id & 1) && !(other.id & 1)){
+                pair_set_remove(&s->overlaps, pair_key(a, b));
+            }
+            list[j + 1] = other;
+            j--;
+        }
+        list[j + 1] = e;
+    }
+}
+
+void sap_find_pairs(SweepAndPrune *s, PairList *out){
+    if (!s->valid || s->ball_count != ball_count || s->generation != ball_generation){
+        sap_rebuild(s);
+    } else {
+        sap_update_bounds(s);
+        sap_sort_axis(s, s->axis[0]);
+        sap_sort_axis(s, s->axis[1]);
+    }
+
+    for (int k = 0; k < s->overlaps.count; k++){
+        Uint64 key = s->overlaps.keys[k];
+        pairs_push(out, (int)(key >> 32), (int)(Uint32)key);
+    }
+}
+
+// Dynamic AABB tree. Leaves hold boxes fattened by TREE_MARGIN, so a ball is
+// only reinserted once it leaves its fat box, and AVL-style rotations keep the
+// tree balanced as leaves come and go.
+#define TREE_MARGIN 5.0f
+#define TREE_NULL (-1)
+
+typedef struct {
+    vec min, max;
+} Aabb;
+
+typedef struct {
+    Aabb box;
+    int parent;         // next free node while on the free list
+    int left, right;
+    int height;         // -1 while on the free list
+    int ball;
+} TreeNode;
+
+typedef struct {
+    TreeNode *nodes;
+    int node_capacity;
+    int root;
+    int free_list;
+    int *ball_leaf;
+    int leaf_count;
+    int leaf_capacity;
+    int *stack;
+    int stack_capacity;
+} AabbTree;
+
+AabbTree tree = {.root = TREE_NULL, .free_list = TREE_NULL};
+
+Aabb aabb_union(Aabb a, Aabb b){
+    return (Aabb){{fminf(a.min.x, b.min.x), fminf(a.min.y, b.min.y)}, {fmaxf(a.max.x, b.max.x), fmaxf(a.max.y, b.max.y)}};
+}
+
+float aabb_perimeter(Aabb a){
+    return 2.0f * ((a.max.x - a.min.x) + (a.max.y - a.min.y));
+}
+
+int aabb_contains(Aabb outer, Aabb inner){
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && inner.max.x <= outer.max.x && inner.max.y <= outer.max.y;
+}
+
+int aabb_touches(Aabb a, Aabb b){
+    return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y;
+}
+
+Aabb ball_aabb(int i, float margin){
+    float r = balls.radius[i] + margin;
+    return (Aabb){{balls.x[i] - r, balls.y[i] - r}, {balls.x[i] + r, balls.y[i] + r}};
+}
+
+int tree_alloc_node(AabbTree *t){
+    if (t->free_list == TREE_NULL){
+        int old_capacity = t->node_capacity;
+        t->node_capacity = old_capacity ? old_capacity * 2 : 256;
+        t->nodes = realloc(t->nodes, t->node_capacity * sizeof(TreeNode));
+        for (int n = old_capacity; n < t->node_capacity; n++){
+            t->nodes[n].parent = n + 1 < t->node_capacity ? n + 1 : TREE_NULL;
+            t->nodes[n].height = -1;
+        }
+        t->free_list = old_capacity;
+    }
+    int n = t->free_list;
+    t->free_list = t->nodes[n].parent;
+    t->nodes[n].parent = TREE_NULL;
+    t->nodes[n].left = TREE_NULL;
+    t->nodes[n].right = TREE_NULL;
+    t->nodes[n].height = 0;
+    t->nodes[n].ball = -1;
+    return n;
+}
+
+void tree_free_node(AabbTree *t, int n){
+    t->nodes[n].parent = t->free_list;
+    t->nodes[n].height = -1;
+    t->free_list = n;
+}
+
+void tree_fix_node(AabbTree *t, int n){
+    TreeNode *node = &t->nodes[n];
+    TreeNode *left = &t->nodes[node->left];
+    TreeNode *right = &t->nodes[node->right];
+    node->box = aabb_union(left->box, right->box);
+    node->height = 1 + (left->height > right->height ? left->height : right->height);
+}
+
+// Rotates the taller grandchild up if node a is out of balance; returns the
+// node now at a's position.
+int tree_balance(AabbTree *t, int a){
+    TreeNode *A = &t->nodes[a];
+    if (A->left == TREE_NULL || A->height < 2) return a;
+
+    int b = A->left;
+    int c = A->right;
+    int balance = t->nodes[c].height - t->nodes[b].height;
+    if (balance >= -1 && balance <= 1) return a;
+
+    // Promote the taller child (up) and hand one of its children to a.
+    int up = balance > 1 ? c : b;
+    int stay = balance > 1 ? b : c;
+    TreeNode *U = &t->nodes[up];
+    int f = U->left;
+    int g = U->right;
+
+    U->left = a;
+    U->parent = A->parent;
+    A->parent = up;
+    if (U->parent == TREE_NULL) t->root = up;
+    else if (t->nodes[U->parent].left == a) t->nodes[U->parent].left = up;
+    else t->nodes[U->parent].right = up;
+
+    int keep = t->nodes[f].height > t->nodes[g].height ? f : g;
+    int give = keep == f ? g : f;
+    U->right = keep;
+    A->left = stay;
+    A->right = give;
+    t->nodes[give].parent = a;
+    tree_fix_node(t, a);
+    tree_fix_node(t, up);
+    return up;
+}
+
+void tree_refit_from(AabbTree *t, int n){
+    while (n != TREE_NULL){
+        n = tree_balance(t, n);
+        tree_fix_node(t, n);
+        n = t->nodes[n].parent;
+    }
+}
+
+void tree_insert_leaf(AabbTree *t, int leaf){
+    if (t->root == TREE_NULL){
+        t->root = leaf;
+        t->nodes[leaf].parent = TREE_NULL;
+        return;
+    }
+
+    // Descend towards the sibling that grows the total perimeter least.
+    Aabb box = t->nodes[leaf].box;
+    int n = t->root;
+    while (t->nodes[n].left != TREE_NULL){
+        TreeNode *node = &t->nodes[n];
+        float combined = aabb_perimeter(aabb_union(node->box, box));
+        float cost = 2.0f * combined;
+        float inherited = 2.0f * (combined - aabb_perimeter(node->box));
+
+        float child_cost[2];
+        int child[2] = {node->left, node->right};
+        for (int k = 0; k < 2; k++){
+            TreeNode *c = &t->nodes[child[k]];
+            float grown = aabb_perimeter(aabb_union(c->box, box));
+            child_cost[k] = inherited + (c->left == TREE_NULL ? grown : grown - aabb_perimeter(c->box));
+        }
+        if (cost < child_cost[0] && cost < child_cost[1]) break;
+        n = child_cost[0] < child_cost[1] ? child[0] : child[1];
+    }
+
+    int sibling = n;
+    int old_parent = t->nodes[sibling].parent;
+    int new_parent = tree_alloc_node(t);
+    t->nodes[new_parent].parent = old_parent;
+    t->nodes[new_parent].left = sibling;
+    t->nodes[new_parent].right = leaf;
+    t->nodes[sibling].parent = new_parent;
+    t->nodes[leaf].parent = new_parent;
+
+    if (old_parent == TREE_NULL) t->root = new_parent;
+    else if (t->nodes[old_parent].left == sibling) t->nodes[old_parent].left = new_parent;
+    else t->nodes[old_parent].right = new_parent;
+
+    tree_refit_from(t, new_parent);
+}
+
+void tree_remove_leaf(AabbTree *t, int leaf){
+    if (leaf == t->root){
+        t->root = TREE_NULL;
+        return;
+    }
+
+    int parent = t->nodes[leaf].parent;
+    int grand_parent = t->nodes[parent].parent;
+    int sibling = t->nodes[parent].left == leaf ? t->nodes[parent].right : t->nodes[parent].left;
+
+    if (grand_parent == TREE_NULL){
+        t->root = sibling;
+        t->nodes[sibling].parent = TREE_NULL;
+        tree_free_node(t, parent);
+        return;
+    }
+
+    if (t->nodes[grand_parent].left == parent) t->nodes[grand_parent].left = sibling;
+    else t->nodes[grand_parent].right = sibling;
+    t->nodes[sibling].parent = grand_parent;
+    tree_free_node(t, parent);
+    tree_refit_from(t, grand_parent);
+}
+
+// Brings the leaves in line with the balls: adds or drops leaves when the ball
+// count changed and reinserts any ball that escaped its fat box.
+void tree_update(AabbTree *t){
+    if (ball_count > t->leaf_capacity){
+        t->leaf_capacity = ball_count * 2;
+        t->ball_leaf = realloc(t->ball_leaf, t->leaf_capacity * sizeof(int));
+    }
+    while (t->leaf_count > ball_count){
+        int leaf = t->ball_leaf[--t->leaf_count];
+        tree_remove_leaf(t, leaf);
+        tree_free_node(t, leaf);
+    }
+    while (t->leaf_count < ball_count){
+        int leaf = tree_alloc_node(t);
+        t->nodes[leaf].ball = t->leaf_count;
+        t->nodes[leaf].box = ball_aabb(t->leaf_count, TREE_MARGIN);
+        t->ball_leaf[t->leaf_count++] = leaf;
+        tree_insert_leaf(t, leaf);
+    }
+
+    for (int i = 0; i < ball_count; i++){
+        int leaf = t->ball_leaf[i];
+        if (aabb_contains(t->nodes[leaf].box, ball_aabb(i, 0.0f))) continue;
+        tree_remove_leaf(t, leaf);
+        t->nodes[leaf].box = ball_aabb(i, TREE_MARGIN);
+        tree_insert_leaf(t, leaf);
+    }
+}
+
+// Calls visit for every ball whose fat box touches the query box.
+void tree_query(AabbTree *t, Aabb box, void (*visit)(int ball, void *data), void *data){
+    if (t->root == TREE_NULL) return;
+
+    int depth = 0;
+    t->stack[depth++] = t->root;
+    while (depth > 0){
+        int n = t->stack[--depth];
+        TreeNode *node = &t->nodes[n];
+        if (!aabb_touches(node->box, box)) continue;
+
+        if (node->left == TREE_NULL){
+            visit(node->ball, data);
+        } else {
+            if (depth + 2 > t->stack_capacity){
+                t->stack_capacity *= 2;
+                t->stack = realloc(t->stack, t->stack_capacity * sizeof(int));
+            }
+            t->stack[depth++] = node->left;
+            t->stack[depth++] = node->right;
+        }
+    }
+}
+
+typedef struct {
+    int ball;
+    PairList *out;
+} TreePairQuery;
+
+void tree_visit_pair(int other, void *data){
+    TreePairQuery *q = data;
+    if (other > q->ball && aabb_overlap(q->ball, other)) pairs_push(q->out, q->ball, other);
+}
+
+void tree_find_pairs(AabbTree *t, PairList *out){
+    if (!t->stack){
+        t->stack_capacity = 256;
+        t->stack = malloc(t->stack_capacity * sizeof(int));
+    }
+    tree_update(t);
+
+    TreePairQuery q = {0, out};
+    for (int i = 0; i < ball_count; i++){
+        q.ball = i;
+        tree_query(t, ball_aabb(i, 0.0f), tree_visit_pair, &q);
+    }
+}
+
+// Hierarchical grid: level k has cells twice as wide as level k - 1, and each
+// ball lives in the finest level whose cells span its diameter. Pairs within
+// a level use the usual half stencil; across levels a ball only looks up the
+// 3x3 neighbourhood on each coarser level, so every pair is found once.
+#define HGRID_MAX_LEVELS 12
+
+typedef struct {
+    Grid levels[HGRID_MAX_LEVELS];
+    int level_count;
+    int level_start[HGRID_MAX_LEVELS + 1];
+    int *members;       // balls sorted by level
+    int *ball_level;
+    int capacity;
+} HGrid;
+
+HGrid hgrid;
+
+void hgrid_build(HGrid *h, float width, float height){
+    if (ball_count > h->capacity){
+        h->capacity = ball_count;
+        h->members = realloc(h->members, h->capacity * sizeof(int));
+        h->ball_level = realloc(h->ball_level, h->capacity * sizeof(int));
+    }
+
+    float base = grid_fit_cell_size(2.0f * min_ball_radius(), width, height);
+    float max_diameter = 2.0f * max_ball_radius();
+    h->level_count = 1;
+    while (h->level_count < HGRID_MAX_LEVELS && base * (float)(1 << (h->level_count - 1)) < max_diameter) h->level_count++;
+
+    int counts[HGRID_MAX_LEVELS] = {0};
+    for (int i = 0; i < ball_count; i++){
+        int level = 0;
+        float cell = base;
+        while (level < h->level_count - 1 && cell < 2.0f * balls.radius[i]){
+            cell *= 2.0f;
+            level++;
+        }
+        h->ball_level[i] = level;
+        counts[level]++;
+    }
+
+    h->level_start[0] = 0;
+    for (int l = 0; l < h->level_count; l++) h->level_start[l + 1] = h->level_start[l] + counts[l];
+    for (int l = 0; l < h->level_count; l++) counts[l] = h->level_start[l];
+    for (int i = 0; i < ball_count; i++) h->members[counts[h->ball_level[i]]++] = i;
+
+    // The top level takes whatever is left, so size it to the largest ball.
+    for (int l = 0; l < h->level_count; l++){
+        float cell = base * (float)(1 << l);
+        if (l == h->level_count - 1 && cell < max_diameter) cell = max_diameter;
+        grid_build(&h->levels[l], cell, width, height, h->members + h->level_start[l], h->level_start[l + 1] - h->level_start[l]);
+    }
+}
+
+void hgrid_find_pairs(HGrid *h, PairList *out){
+    hgrid_build(h, WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    for (int l = 0; l < h->level_count; l++){
+        if (h->level_start[l] == h->level_start[l + 1]) continue;
+        grid_find_pairs(&h->levels[l], out, 0.0f);
+
+        for (int coarse = l + 1; coarse < h->level_count; coarse++){
+            Grid *g = &h->levels[coarse];
+            if (h->level_start[coarse] == h->level_start[coarse + 1]) continue;
+
+            for (int k = h->level_start[l]; k < h->level_start[l + 1]; k++){
+                int i = h->members[k];
+                int cx = grid_coord(balls.x[i], g->inv_cell_size, g->cols);
+                int cy = grid_coord(balls.y[i], g->inv_cell_size, g->rows);
+                for (int ny = cy - 1; ny <= cy + 1; ny++){
+                    if (ny < 0 || ny >= g->rows) continue;
+                    for (int nx = cx - 1; nx <= cx + 1; nx++){
+                        if (nx < 0 || nx >= g->cols) continue;
+                        int c = ny * g->cols + nx;
+                        for (int m = g->cell_start[c]; m < g->cell_start[c + 1]; m++){
+                            if (aabb_overlap(i, g->cell_balls[m])) pairs_push(out, i, g->cell_balls[m]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Verlet neighbour lists: per-ball lists of every later ball within
+// radius + skin, built on a grid with cells one skin wider. No pair can come
+// into contact before some ball has moved skin / 2 from where it was at the
+// last build, so until then the cached lists are just re-tested. Checking
+// that is a pass over every ball's displacement each step; the saving is the
+// skipped grid build and neighbour search.
+typedef struct {
+    float skin;
+    int *start;         // per ball offset into neighbours, ball_count + 1 long
+    int *neighbours;
+    int neighbour_capacity;
+    float *ref_x, *ref_y;
+    int capacity;
+    int generation;
+    int valid;
+    int rebuilds;
+    PairList scratch;
+} VerletList;
+
+VerletList verlet = {.skin = 10.0f};
+
+float verlet_max_displacement2(VerletList *v){
+    float max_d2 = 0.0f;
+    for (int i = 0; i < ball_count; i++){
+        float dx = balls.x[i] - v->ref_x[i];
+        float dy = balls.y[i] - v->ref_y[i];
+        float d2 = dx * dx + dy * dy;
+        if (d2 > max_d2) max_d2 = d2;
+    }
+    return max_d2;
+}
+
+void verlet_rebuild(VerletList *v){
+    // start is one longer than the ball count, so it is needed with no balls
+    if (!v->start || ball_count > v->capacity){
+        v->capacity = ball_count;
+        v->start = realloc(v->start, (v->capacity + 1) * sizeof(int));
+        v->ref_x = realloc(v->ref_x, v->capacity * sizeof(float));
+        v->ref_y = realloc(v->ref_y, v->capacity * sizeof(float));
+    }
+
+    v->scratch.count = 0;
+    grid_build(&grid, 2.0f * max_ball_radius() + v->skin, WINDOW_WIDTH, WINDOW_HEIGHT, NULL, ball_count);
+    grid_find_pairs(&grid, &v->scratch, v->skin);
+
+    // Bucket the pairs by their lower ball to get the per-ball lists.
+    if (v->scratch.count > v->neighbour_capacity){
+        v->neighbour_capacity = v->scratch.count;
+        v->neighbours = realloc(v->neighbours, v->neighbour_capacity * sizeof(int));
+    }
+    memset(v->start, 0, (ball_count + 1) * sizeof(int));
+    for (int p = 0; p < v->scratch.count; p++){
+        int a = v->scratch.a[p] < v->scratch.b[p] ? v->scratch.a[p] : v->scratch.b[p];
+        v->start[a + 1]++;
+    }
+    for (int i = 0; i < ball_count; i++) v->start[i + 1] += v->start[i];
+    for (int p = 0; p < v->scratch.count; p++){
+        int a = v->scratch.a[p];
+        int b = v->scratch.b[p];
+        if (a > b){
+            int t = a;
+            a = b;
+            b = t;
+        }
+        v->neighbours[v->start[a]++] = b;
+    }
+    for (int i = ball_count; i > 0; i--) v->start[i] = v->start[i - 1];
+    v->start[0] = 0;
+
+    for (int i = 0; i < ball_count; i++){
+        v->ref_x[i] = balls.x[i];
+        v->ref_y[i] = balls.y[i];
+    }
+    v->generation = ball_generation;
+    v->valid = 1;
+    v->rebuilds++;
+}
+
+void verlet_find_pairs(VerletList *v, PairList *out){
+    float half_skin = 0.5f * v->skin;
+    if (!v->valid || v->generation != ball_generation || verlet_max_displacement2(v) > half_skin * half_skin){
+        verlet_rebuild(v);
+    }
+
+    for (int i = 0; i < ball_count; i++){
+        for (int k = v->start[i]; k < v->start[i + 1]; k++){
+            if (aabb_overlap(i, v->neighbours[k])) pairs_push(out, i, v->neighbours[k]);
+        }
+    }
+}
+
+// Incrementally maintained grid: every cell heads an intrusive doubly linked
+// list of its balls. After integration only balls whose cell changed are
+// relinked. Finding them is still one cell computation per ball every step;
+// what is saved is rewriting the buckets, which a full build does for every
+// ball. The grid is rebuilt from scratch only when balls are added or removed
+// or the window size changes.
+typedef struct {
+    float inv_cell_size;
+    int cols, rows;
+    int width, height;
+    int *cell_head;
+    int cell_capacity;
+    int *ball_cell;
+    int *next, *prev;
+    int capacity;
+    int generation;
+    int valid;
+    int moved;
+} IncrementalGrid;
+
+IncrementalGrid incremental_grid;
+
+int incremental_grid_cell(IncrementalGrid *g, int i){
+    int cx = grid_coord(balls.x[i], g->inv_cell_size, g->cols);
+    int cy = grid_coord(balls.y[i], g->inv_cell_size, g->rows);
+    return cy * g->cols + cx;
+}
+
+void incremental_grid_link(IncrementalGrid *g, int i, int cell){
+    g->ball_cell[i] = cell;
+    g->prev[i] = -1;
+    g->next[i] = g->cell_head[cell];
+    if (g->cell_head[cell] >= 0) g->prev[g->cell_head[cell]] = i;
+    g->cell_head[cell] = i;
+}
+
+void incremental_grid_unlink(IncrementalGrid *g, int i){
+    if (g->prev[i] >= 0) g->next[g->prev[i]] = g->next[i];
+    else g->cell_head[g->ball_cell[i]] = g->next[i];
+    if (g->next[i] >= 0) g->prev[g->next[i]] = g->prev[i];
+}
+
+void incremental_grid_rebuild(IncrementalGrid *g){
+    float cell_size = grid_fit_cell_size(2.0f * max_ball_radius(), WINDOW_WIDTH, WINDOW_HEIGHT);
+    g->inv_cell_size = 1.0f / cell_size;
+    g->cols = (int)(WINDOW_WIDTH * g->inv_cell_size) + 1;
+    g->rows = (int)(WINDOW_HEIGHT * g->inv_cell_size) + 1;
+    g->width = WINDOW_WIDTH;
+    g->height = WINDOW_HEIGHT;
+
+    int cell_count = g->cols * g->rows;
+    if (cell_count > g->cell_capacity){
+        g->cell_capacity = cell_count;
+        g->cell_head = realloc(g->cell_head, g->cell_capacity * sizeof(int));
+    }
+    if (ball_count > g->capacity){
+        g->capacity = ball_count;
+        g->ball_cell = realloc(g->ball_cell, g->capacity * sizeof(int));
+        g->next = realloc(g->next, g->capacity * sizeof(int));
+        g->prev = realloc(g->prev, g->capacity * sizeof(int));
+    }
+
+    for (int c = 0; c < cell_count; c++) g->cell_head[c] = -1;
+    for (int i = ball_count - 1; i >= 0; i--) incremental_grid_link(g, i, incremental_grid_cell(g, i));
+
+    g->generation = ball_generation;
+    g->valid = 1;
+}
+
+void incremental_grid_update(IncrementalGrid *g){
+    if (!g->valid || g->generation != ball_generation || g->width != WINDOW_WIDTH || g->height != WINDOW_HEIGHT){
+        incremental_grid_rebuild(g);
+        g->moved = ball_count;
+        return;
+    }
+
+    g->moved = 0;
+    for (int i = 0; i < ball_count; i++){
+        int cell = incremental_grid_cell(g, i);
+        if (cell == g->ball_cell[i]) continue;
+        incremental_grid_unlink(g, i);
+        incremental_grid_link(g, i, cell);
+        g->moved++;
+    }
+}
+
+void incremental_grid_find_pairs(IncrementalGrid *g, PairList *out){
+    incremental_grid_update(g);
+
+    for (int i = 0; i < ball_count; i++){
+        int cx = g->ball_cell[i] % g->cols;
+        int cy = g->ball_cell[i] / g->cols;
+        for (int ny = cy - 1; ny <= cy + 1; ny++){
+            if (ny < 0 || ny >= g->rows) continue;
+            for (int nx = cx - 1; nx <= cx + 1; nx++){
+                if (nx < 0 || nx >= g->cols) continue;
+                for (int j = g->cell_head[ny * g->cols + nx]; j >= 0; j = g->next[j]){
+                    if (j > i && aabb_overlap(i, j)) pairs_push(out, i, j);
+                }
+            }
+        }
+    }
+}
+
+void grid_backend_find_pairs(PairList *out){
+    grid_build(&grid, 2.0f * max_ball_radius(), WINDOW_WIDTH, WINDOW_HEIGHT, NULL, ball_count);
+    grid_find_pairs(&grid, out, 0.0f);
+}
+
+void sap_backend_find_pairs(PairList *out){
+    sap_find_pairs(&sap, out);
+}
+
+void sap_backend_reset(void){
+    sap.valid = 0;
+}
+
+void sap_backend_remap(const int *old_to_new){
+    if (!sap.valid || sap.generation != ball_generation) return;
+    for (int a = 0; a < 2; a++){
+        for (int k = 0; k < 2 * sap.ball_count; k++){
+            int id = sap.axis[a][k].id;
+            sap.axis[a][k].id = old_to_new[id >> 1] * 2 + (id & 1);
+        }
+    }
+
+    int count = sap.overlaps.count;
+    pair_set_clear(&sap.overlaps);
+    for (int k = 0; k < count; k++){
+        Uint64 key = sap.overlaps.keys[k];
+        pair_set_insert(&sap.overlaps, pair_key(old_to_new[(int)(key >> 32)], old_to_new[(int)(Uint32)key]));
+    }
+}
+
+void tree_backend_find_pairs(PairList *out){
+    tree_find_pairs(&tree, out);
+}
+
+void tree_backend_remap(const int *old_to_new){
+    // A tree that has not caught up with added or removed balls cannot be
+    // renumbered leaf for leaf; drop it and let the next update reinsert.
+    if (tree.leaf_count != ball_count){
+        tree.root = TREE_NULL;
+        tree.free_list = TREE_NULL;
+        for (int n = tree.node_capacity - 1; n >= 0; n--) tree_free_node(&tree, n);
+        tree.leaf_count = 0;
+        return;
+    }
+
+    for (int i = 0; i < tree.leaf_count; i++) tree.nodes[tree.ball_leaf[i]].ball = old_to_new[i];
+    for (int n = 0; n < tree.node_capacity; n++){
+        if (tree.nodes[n].height == 0) tree.ball_leaf[tree.nodes[n].ball] = n;
+    }
+}
+
+void hgrid_backend_find_pairs(PairList *out){
+    hgrid_find_pairs(&hgrid, out);
+}
+
+void verlet_backend_find_pairs(PairList *out){
+    verlet_find_pairs(&verlet, out);
+}
+
+void verlet_backend_reset(void){
+    verlet.valid = 0;
+}
+
+void incremental_grid_backend_find_pairs(PairList *out){
+    incremental_grid_find_pairs(&incremental_grid, out);
+}
+
+void incremental_grid_backend_reset(void){
+    incremental_grid.valid = 0;
+}
+
+// A broadphase back-end appends every pair whose boxes may overlap to out.
+// reset, if set, drops persistent state before the back-end is reactivated.
+// remap, if set, renumbers stored ball indices after the balls are reordered.
+typedef struct {
+    const char *name;
+    void (*find_pairs)(PairList *out);
+    void (*reset)(void);
+    void (*remap)(const int *old_to_new);
+    Uint64 build_ticks;
+    int pair_tests;
+    int pair_count;
+} Broadphase;
+
+Broadphase broadphases[BROADPHASE_COUNT] = {
+    {"brute force", find_pairs_brute, NULL, NULL, 0, 0, 0},
+    {"uniform grid", grid_backend_find_pairs, NULL, NULL, 0, 0, 0},
+    {"sweep and prune", sap_backend_find_pairs, sap_backend_reset, sap_backend_remap, 0, 0, 0},
+    {"aabb tree", tree_backend_find_pairs, NULL, tree_backend_remap, 0, 0, 0},
+    {"hierarchical grid", hgrid_backend_find_pairs, NULL, NULL, 0, 0, 0},
+    {"verlet lists", verlet_backend_find_pairs, verlet_backend_reset, NULL, 0, 0, 0},
+    {"incremental grid", incremental_grid_backend_find_pairs, incremental_grid_backend_reset, NULL, 0, 0, 0},
+};
+
+const char *broadphase_mode_name(BroadphaseMode mode){
+    return mode == BROADPHASE_AUTO ? "auto" : broadphases[mode].name;
+}
+
+// Auto mode times each back-end for AUTO_TRIAL_FRAMES steps (the first one is
+// a warm-up that absorbs rebuilds), keeps the fastest, and runs the trials
+// again once the ball count or the radius spread has drifted far enough.
+#define AUTO_TRIAL_FRAMES 5
+#define AUTO_BRUTE_LIMIT 1000
+#define AUTO_COUNT_DRIFT 1.5f
+#define AUTO_SPREAD_DRIFT 2.0f
+
+typedef struct {
+    int trial;          // back-end under trial, or -1 once one is chosen
+    int trial_frame;
+    Uint64 trial_ticks[BROADPHASE_COUNT];
+    int chosen;
+    int chosen_ball_count;
+    float chosen_spread;
+} BroadphaseAuto;
+
+BroadphaseAuto broadphase_auto = {.trial = -1, .chosen = -1};
+
+int auto_eligible(int backend){
+    return backend != BROADPHASE_BRUTE || ball_count <= AUTO_BRUTE_LIMIT;
+}
+
+int auto_next_trial(int after){
+    for (int b = after + 1; b < BROADPHASE_COUNT; b++){
+        if (auto_eligible(b)) return b;
+    }
+    return -1;
+}
+
+float radius_spread(void){
+    float min_radius = min_ball_radius();
+    return min_radius > 0.0f ? max_ball_radius() / min_radius : 1.0f;
+}
+
+int auto_drifted(BroadphaseAuto *a){
+    float count_ratio = (float)(ball_count + 1) / (float)(a->chosen_ball_count + 1);
+    float spread_ratio = radius_spread() / a->chosen_spread;
+    return count_ratio > AUTO_COUNT_DRIFT || count_ratio < 1.0f / AUTO_COUNT_DRIFT ||
+           spread_ratio > AUTO_SPREAD_DRIFT || spread_ratio < 1.0f / AUTO_SPREAD_DRIFT;
+}
+
+int auto_pick(BroadphaseAuto *a){
+    if (a->trial < 0 && (a->chosen < 0 || auto_drifted(a))){
+        a->trial = auto_next_trial(-1);
+        a->trial_frame = 0;
+        for (int b = 0; b < BROADPHASE_COUNT; b++) a->trial_ticks[b] = 0;
+    }
+    return a->trial >= 0 ? a->trial : a->chosen;
+}
+
+void auto_record(BroadphaseAuto *a, int backend, Uint64 ticks){
+    if (a->trial != backend) return;
+    if (a->trial_frame++ > 0) a->trial_ticks[backend] += ticks;
+    if (a->trial_frame < AUTO_TRIAL_FRAMES) return;
+
+    a->trial_frame = 0;
+    a->trial = auto_next_trial(backend);
+    if (a->trial >= 0) return;
+
+    a->chosen = -1;
+    for (int b = 0; b < BROADPHASE_COUNT; b++){
+        if (auto_eligible(b) && (a->chosen < 0 || a->trial_ticks[b] < a->trial_ticks[a->chosen])) a->chosen = b;
+    }
+    a->chosen_ball_count = ball_count;
+    a->chosen_spread = radius_spread();
+    printf("Broadphase auto: picked %s (%.3f ms per step)\n", broadphases[a->chosen].name,
+           (double)a->trial_ticks[a->chosen] * 1000.0 / (double)SDL_GetPerformanceFrequency() / (AUTO_TRIAL_FRAMES - 1));
+}
+
+void find_pairs(PairList *out){
+    out->count = 0;
+
+    BroadphaseMode backend = broadphase_mode == BROADPHASE_AUTO ? (BroadphaseMode)auto_pick(&broadphase_auto) : broadphase_mode;
+    Broadphase *bp = &broadphases[backend];
+    if (backend != broadphase_active && bp->reset) bp->reset();
+    broadphase_active = backend;
+
+    broadphase_pair_tests = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    bp->find_pairs(out);
+    bp->build_ticks = SDL_GetPerformanceCounter() - start;
+    bp->pair_tests = broadphase_pair_tests;
+    bp->pair_count = out->count;
+
+    if (broadphase_mode == BROADPHASE_AUTO) auto_record(&broadphase_auto, backend, bp->build_ticks);
+}
+
+void print_broadphase_stats(void){
+    Broadphase *bp = &broadphases[broadphase_active];
+    printf("Broadphase %s: %.3f ms, %d pair tests, %d pairs\n", bp->name,
+           (double)bp->build_ticks * 1000.0 / (double)SDL_GetPerformanceFrequency(), bp->pair_tests, bp->pair_count);
+    if (broadphase_active == BROADPHASE_VERLET) printf("Verlet lists rebuilt %d times\n", verlet.rebuilds);
+    if (broadphase_active == BROADPHASE_INCREMENTAL_GRID) printf("Balls that changed cell: %d\n", incremental_grid.moved);
+}
+
+// Spatial reordering: every reorder_interval steps the balls are sorted by the
+// Morton code of their position (LSD radix sort, 8 bits per pass), so balls
+// that are close in space are also close in memory. Back-ends renumber their
+// stored indices through remap; the Verlet lists and the incremental grid are
+// simply rebuilt, which costs the same as renumbering them.
+int reorder_interval = 0;
+int reorder_step = 0;
+Uint64 reorder_ticks = 0;
+
+typedef struct {
+    Uint32 *keys, *keys_tmp;
+    int *order, *order_tmp;
+    int *old_to_new;
+    float *scratch;
+    int capacity;
+} Reorder;
+
+Reorder reorder;
+
+Uint32 morton_spread(Uint32 v){
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+Uint32 morton_key(float x, float y, float inv_width, float inv_height){
+    float fx = x * inv_width;
+    float fy = y * inv_height;
+    Uint32 qx = fx <= 0.0f ? 0 : fx >= 1.0f ? 0xFFFF : (Uint32)(fx * 65535.0f);
+    Uint32 qy = fy <= 0.0f ? 0 : fy >= 1.0f ? 0xFFFF : (Uint32)(fy * 65535.0f);
+    return morton_spread(qx) | (morton_spread(qy) << 1);
+}
+
+void permute_floats(float *values, const int *order, float *scratch){
+    for (int k = 0; k < ball_count; k++) scratch[k] = values[order[k]];
+    memcpy(values, scratch, ball_count * sizeof(float));
+}
+
+void reorder_balls(Reorder *r){
+    if (ball_count > r->capacity){
+        r->capacity = ball_count;
+        r->keys = realloc(r->keys, r->capacity * sizeof(Uint32));
+        r->keys_tmp = realloc(r->keys_tmp, r->capacity * sizeof(Uint32));
+        r->order = realloc(r->order, r->capacity * sizeof(int));
+        r->order_tmp = realloc(r->order_tmp, r->capacity * sizeof(int));
+        r->old_to_new = realloc(r->old_to_new, r->capacity * sizeof(int));
+        r->scratch = realloc(r->scratch, r->capacity * sizeof(float));
+    }
+
+    float inv_width = 1.0f / (float)WINDOW_WIDTH;
+    float inv_height = 1.0f / (float)WINDOW_HEIGHT;
+    for (int i = 0; i < ball_count; i++){
+        r->keys[i] = morton_key(balls.x[i], balls.y[i], inv_width, inv_height);
+        r->order[i] = i;
+    }
+
+    for (int shift = 0; shift < 32; shift += 8){
+        int offsets[256] = {0};
+        for (int i = 0; i < ball_count; i++) offsets[(r->keys[i] >> shift) & 0xFF]++;
+        if (offsets[(r->keys[0] >> shift) & 0xFF] == ball_count) continue;
+
+        int sum = 0;
+        for (int d = 0; d < 256; d++){
+            int count = offsets[d];
+            offsets[d] = sum;
+            sum += count;
+        }
+        for (int i = 0; i < ball_count; i++){
+            int dst = offsets[(r->keys[i] >> shift) & 0xFF]++;
+            r->keys_tmp[dst] = r->keys[i];
+            r->order_tmp[dst] = r->order[i];
+        }
+
+        Uint32 *keys = r->keys;
+        r->keys = r->keys_tmp;
+        r->keys_tmp = keys;
+        int *order = r->order;
+        r->order = r->order_tmp;
+        r->order_tmp = order;
+    }
+
+    permute_floats(balls.x, r->order, r->scratch);
+    permute_floats(balls.y, r->order, r->scratch);
+    permute_floats(balls.vx, r->order, r->scratch);
+    permute_floats(balls.vy, r->order, r->scratch);
+    permute_floats(balls.radius, r->order, r->scratch);
+    permute_floats(balls.mass, r->order, r->scratch);
+    permute_floats(balls.inv_mass, r->order, r->scratch);
+
+    for (int k = 0; k < ball_count; k++) r->old_to_new[r->order[k]] = k;
+    for (int b = 0; b < BROADPHASE_COUNT; b++){
+        if (broadphases[b].remap) broadphases[b].remap(r->old_to_new);
+        else if (broadphases[b].reset) broadphases[b].reset();
+    }
+}
+
+// Spatial query: visits every ball whose circle overlaps the given circle.
+// Runs against the AABB tree when it is the active broadphase.
+typedef struct {
+    vec center;
+    float radius;
+    void (*visit)(int ball, void *data);
+    void *data;
+} CircleQuery;
+
+void circle_query_visit(int ball, void *data){
+    CircleQuery *q = data;
+    float reach = q->radius + balls.radius[ball];
+    if (v_len2(v_sub(ball_position(ball), q->center)) < reach * reach) q->visit(ball, q->data);
+}
+
+void query_balls_in_circle(float x, float y, float radius, void (*visit)(int ball, void *data), void *data){
+    CircleQuery q = {{x, y}, radius, visit, data};
+    if (broadphase_active == BROADPHASE_TREE && tree.stack){
+        tree_update(&tree);
+        tree_query(&tree, (Aabb){{x - radius, y - radius}, {x + radius, y + radius}}, circle_query_visit, &q);
+        return;
+    }
+    for (int i = 0; i < ball_count; i++) circle_query_visit(i, &q);
+}
+
+// Kicks a ball along d, its offset from the push centre.
+void push_ball_away(int ball, vec d){
+    float len = sqrtf(v_len2(d)) + 0.1f;
+    set_ball_velocity(ball, v_add(ball_velocity(ball), v_mul(d, 400.0f / len)));
+}
+
+void push_away_visit(int ball, void *data){
+    vec *center = data;
+    push_ball_away(ball, v_sub(ball_position(ball), *center));
+}
+
+// Large world (L key): each ball's position is an integer tile plus a float
+// offset inside it, so precision is the same everywhere in a world about 10^6
+// units across. balls.x/y hold the offsets and the float kernels run on them
+// unchanged; only code relating two balls adds their tile difference.
+#define WORLD_TILE_SIZE 1024.0f
+#define WORLD_TILES 1024
+
+typedef struct {
+    Sint32 *x, *y;
+    int count;
+    int capacity;
+} BallTiles;
+
+BallTiles tiles;
+int large_world = 0;
+
+// Offset from the point at offset inside tile to ball j in world units.
+float world_point_dx(Sint32 tile, float offset, int j){
+    return balls.x[j] - offset + (float)(tiles.x[j] - tile) * WORLD_TILE_SIZE;
+}
+
+float world_point_dy(Sint32 tile, float offset, int j){
+    return balls.y[j] - offset + (float)(tiles.y[j] - tile) * WORLD_TILE_SIZE;
+}
+
+// Offset from ball i to ball j in world units.
+float world_dx(int i, int j){
+    return world_point_dx(tiles.x[i], balls.x[i], j);
+}
+
+float world_dy(int i, int j){
+    return world_point_dy(tiles.y[i], balls.y[i], j);
+}
+
+// Contacts that survived the narrowphase: the ball pair, the unit normal from
+// a to b and the penetration depth.
+typedef struct {
+    int *a, *b;
+    float *nx, *ny;
+    float *depth;
+    int count;
+    int capacity;
+} ContactList;
+
+ContactList contacts;
+
+void contacts_reserve(ContactList *c, int capacity){
+    if (capacity <= c->capacity) return;
+    c->capacity = capacity + capacity / 2;
+    c->a = realloc(c->a, c->capacity * sizeof(int));
+    c->b = realloc(c->b, c->capacity * sizeof(int));
+    c->nx = realloc(c->nx, c->capacity * sizeof(float));
+    c->ny = realloc(c->ny, c->capacity * sizeof(float));
+    c->depth = realloc(c->depth, c->capacity * sizeof(float));
+}
+
+// Exact test for a candidate that passed the squared-distance reject; reach
+// is ri + rj.
+void narrowphase_emit(int i, int j, float dx, float dy, float reach, ContactList *out){
+    float dist = sqrt(dx * dx + dy * dy) + 0.1f;
+    if (dist >= reach) return;
+
+    // coincident centres (e.g. balls spawned on the same click that drew the
+    // same velocity) have no direction; separate them along x
+    if (dx == 0 && dy == 0) dx = dist;
+
+    int k = out->count++;
+    out->a[k] = i;
+    out->b[k] = j;
+    out->nx[k] = dx / dist;
+    out->ny[k] = dy / dist;
+    out->depth[k] = reach - dist;
+}
+
+// Contact solver: each contact pushes both balls apart by half the
+// penetration along the normal and then exchanges momentum along the line of
+// centres, weighted by the precomputed inverse masses. Within a range the
+// contacts are applied in order, so a ball in several contacts sees the
+// result of the earlier ones. order, when not NULL, maps the range onto
+// contact indices. When every ball has the same mass the _uniform variants
+// skip the mass factors, which are then 1.
+// world is the large world's tiles, or NULL when positions are absolute.
+SDL_FORCE_INLINE void solve_contacts_scalar_body(const BallArrays *b, const ContactList *c, const int *order, int begin, int end, int uniform, const BallTiles *world){
+    float percent = 0.5f;
+
+    for (int n = begin; n < end; n++){
+        int k = order ? order[n] : n;
+        int i = c->a[k];
+        int j = c->b[k];
+        float push_x = c->nx[k] * c->depth[k] * percent;
+        float push_y = c->ny[k] * c->depth[k] * percent;
+        float xi = b->x[i] - push_x;
+        float yi = b->y[i] - push_y;
+        float xj = b->x[j] + push_x;
+        float yj = b->y[j] + push_y;
+        b->x[i] = xi;
+        b->y[i] = yi;
+        b->x[j] = xj;
+        b->y[j] = yj;
+
+        float dx = xi - xj;
+        float dy = yi - yj;
+        if (world){
+            dx += (float)(world->x[i] - world->x[j]) * WORLD_TILE_SIZE;
+            dy += (float)(world->y[i] - world->y[j]) * WORLD_TILE_SIZE;
+        }
+        float dot = (b->vx[i] - b->vx[j]) * dx + (b->vy[i] - b->vy[j]) * dy;
+        float len2 = dx * dx + dy * dy;
+        // a normal from before earlier contacts moved the balls can push both
+        // onto the same point, leaving no line of centres to act along
+        float si = 0, sj = 0;
+        if (len2 > 0 && uniform) si = sj = dot / len2;
+        else if (len2 > 0){
+            float q = 2.0f * dot / ((b->inv_mass[i] + b->inv_mass[j]) * len2);
+            si = b->inv_mass[j] * q;
+            sj = b->inv_mass[i] * q;
+        }
+        b->vx[i] -= dx * si;
+        b->vy[i] -= dy * si;
+        b->vx[j] += dx * sj;
+        b->vy[j] += dy * sj;
+    }
+}
+
+void solve_contacts_scalar(const BallArrays *b, const ContactList *c, const int *order, int begin, int end){
+    solve_contacts_scalar_body(b, c, order, begin, end, 0, NULL);
+}
+
+void solve_contacts_scalar_uniform(const BallArrays *b, const ContactList *c, const int *order, int begin, int end){
+    solve_contacts_scalar_body(b, c, order, begin, end, 1, NULL);
+}
+
+void solve_contacts_large(const BallArrays *b, const ContactList *c, int begin, int end){
+    solve_contacts_scalar_body(b, c, NULL, begin, end, 0, &tiles);
+}
+
+// Groups contacts into batches of width contacts that share no ball, so a
+// vector solver can gather, update and scatter a whole batch at once. One pass
+// fills up to 32 open batches; each ball keeps a bit mask of the open batches
+// it is already in, and a contact goes into the lowest batch free for both of
+// its balls. A full batch is appended to order and its balls' bits are
+// cleared for reuse. Contacts whose balls are in every open batch, and the
+// batches still open at the end, follow as leftovers. Returns the number of
+// batched contacts.
+//
+// The solve is bound by the gathers and scatters rather than the arithmetic,
+// so batching rarely pays for itself; it is the SOLVER_BATCHED mode.
+#define CONTACT_BATCH_SLOTS 32
+#define CONTACT_BATCH_MAX_WIDTH 16
+
+typedef struct {
+    Uint32 *busy;
+    int busy_capacity;
+    int slot[CONTACT_BATCH_SLOTS][CONTACT_BATCH_MAX_WIDTH];
+    int slot_count[CONTACT_BATCH_SLOTS];
+    int *order, *leftover;
+    int capacity;
+    int batched;
+} ContactBatcher;
+
+ContactBatcher contact_batcher;
+
+// How update_balls resolves contacts; V cycles through the modes.
+typedef enum {
+    SOLVER_SEQUENTIAL,
+    SOLVER_BATCHED,
+    SOLVER_COLOURED,
+    SOLVER_JACOBI,
+    SOLVER_ISLANDS,
+    SOLVER_COUNT,
+} SolverMode;
+
+SolverMode solver_mode = SOLVER_SEQUENTIAL;
+
+const char *solver_mode_name(SolverMode mode){
+    static const char *names[SOLVER_COUNT] = {"sequential", "batched", "coloured", "jacobi", "islands"};
+    return names[mode];
+}
+
+void batch_release(ContactBatcher *cb, const ContactList *c, int s){
+    for (int l = 0; l < cb->slot_count[s]; l++){
+        int k = cb->slot[s][l];
+        cb->busy[c->a[k]] &= ~(1u << s);
+        cb->busy[c->b[k]] &= ~(1u << s);
+    }
+    cb->slot_count[s] = 0;
+}
+
+int batch_contacts(ContactBatcher *cb, const ContactList *c, int width){
+    cb->batched = 0;
+    if (width <= 1 || width > CONTACT_BATCH_MAX_WIDTH || c->count < width) return 0;
+
+    if (cb->busy_capacity < ball_count){
+        cb->busy = realloc(cb->busy, ball_count * sizeof(Uint32));
+        memset(cb->busy + cb->busy_capacity, 0, (ball_count - cb->busy_capacity) * sizeof(Uint32));
+        cb->busy_capacity = ball_count;
+    }
+    if (cb->capacity < c->count){
+        cb->capacity = c->count + c->count / 2;
+        cb->order = realloc(cb->order, cb->capacity * sizeof(int));
+        cb->leftover = realloc(cb->leftover, cb->capacity * sizeof(int));
+    }
+
+    int batched = 0;
+    int leftover_count = 0;
+    for (int k = 0; k < c->count; k++){
+        int i = c->a[k];
+        int j = c->b[k];
+        Uint32 free_slots = ~(cb->busy[i] | cb->busy[j]);
+        if (!free_slots){
+            cb->leftover[leftover_count++] = k;
+            continue;
+        }
+
+        int s = SDL_MostSignificantBitIndex32(free_slots & (~free_slots + 1));
+        cb->busy[i] |= 1u << s;
+        cb->busy[j] |= 1u << s;
+        cb->slot[s][cb->slot_count[s]++] = k;
+        if (cb->slot_count[s] == width){
+            memcpy(cb->order + batched, cb->slot[s], width * sizeof(int));
+            batched += width;
+            batch_release(cb, c, s);
+        }
+    }
+    for (int s = 0; s < CONTACT_BATCH_SLOTS; s++){
+        memcpy(cb->leftover + leftover_count, cb->slot[s], cb->slot_count[s] * sizeof(int));
+        leftover_count += cb->slot_count[s];
+        batch_release(cb, c, s);
+    }
+    memcpy(cb->order + batched, cb->leftover, leftover_count * sizeof(int));
+
+    cb->batched = batched;
+    return batched;
+}
+
+// Greedy colouring of the contact graph: each contact takes the lowest colour
+// neither of its balls has yet, so no two contacts of a colour share a ball.
+// The contacts are then copied into sorted grouped by colour, each colour
+// contiguous, with the few that found no free colour among CONTACT_COLOURS
+// last. Colours are solved one after another (Gauss-Seidel between colours);
+// the contacts inside a colour are independent, so any split of a colour
+// across workers or vector lanes gives the same result.
+#define CONTACT_COLOURS 64
+
+typedef struct {
+    Uint64 *used;       // colours already taken at each ball
+    int used_capacity;
+    Uint8 *colour;      // colour of each contact, CONTACT_COLOURS when none
+    int colour_capacity;
+    int start[CONTACT_COLOURS + 2];
+    int colour_count;
+    ContactList sorted;
+} ContactColouring;
+
+ContactColouring contact_colouring;
+
+int lowest_bit_index64(Uint64 v){
+    Uint32 low = (Uint32)v;
+    if (low) return SDL_MostSignificantBitIndex32(low & (~low + 1));
+    Uint32 high = (Uint32)(v >> 32);
+    return 32 + SDL_MostSignificantBitIndex32(high & (~high + 1));
+}
+
+void colour_contacts(ContactColouring *cc, const ContactList *c){
+    if (cc->used_capacity < ball_count){
+        cc->used = realloc(cc->used, ball_count * sizeof(Uint64));
+        memset(cc->used + cc->used_capacity, 0, (ball_count - cc->used_capacity) * sizeof(Uint64));
+        cc->used_capacity = ball_count;
+    }
+    if (cc->colour_capacity < c->count){
+        cc->colour_capacity = c->count + c->count / 2;
+        cc->colour = realloc(cc->colour, cc->colour_capacity);
+    }
+    contacts_reserve(&cc->sorted, c->count);
+
+    int counts[CONTACT_COLOURS + 1] = {0};
+    cc->colour_count = 0;
+    for (int k = 0; k < c->count; k++){
+        Uint64 free_colours = ~(cc->used[c->a[k]] | cc->used[c->b[k]]);
+        int colour = free_colours ? lowest_bit_index64(free_colours) : CONTACT_COLOURS;
+        if (colour < CONTACT_COLOURS){
+            cc->used[c->a[k]] |= (Uint64)1 << colour;
+            cc->used[c->b[k]] |= (Uint64)1 << colour;
+            if (colour >= cc->colour_count) cc->colour_count = colour + 1;
+        }
+        cc->colour[k] = (Uint8)colour;
+        counts[colour]++;
+    }
+
+    cc->start[0] = 0;
+    for (int colour = 0; colour <= CONTACT_COLOURS; colour++) cc->start[colour + 1] = cc->start[colour] + counts[colour];
+    int next[CONTACT_COLOURS + 1];
+    memcpy(next, cc->start, sizeof(next));
+    for (int k = 0; k < c->count; k++){
+        int dst = next[cc->colour[k]]++;
+        cc->sorted.a[dst] = c->a[k];
+        cc->sorted.b[dst] = c->b[k];
+        cc->sorted.nx[dst] = c->nx[k];
+        cc->sorted.ny[dst] = c->ny[k];
+        cc->sorted.depth[dst] = c->depth[k];
+        cc->used[c->a[k]] = 0;
+        cc->used[c->b[k]] = 0;
+    }
+    cc->sorted.count = c->count;
+}
+
+// Fixed-point world (F key): positions, velocities and radii in Q16.16,
+// stepped with integer arithmetic only, so the same inputs and time steps give
+// bit-identical results on every build and ISA. The float arrays mirror the
+// fixed state after each step for rendering and input.
+#define FX_SHIFT 16
+#define FX_ONE (1 << FX_SHIFT)
+
+typedef Sint32 fixed;
+
+typedef struct {
+    fixed *x, *y, *vx, *vy;
+    fixed *radius;
+    fixed *inv_mass;
+    int count;
+    int capacity;
+    int generation;
+} FixedArrays;
+
+FixedArrays fixed_balls;
+int fixed_mode = 0;
+
+fixed fx_from_float(float v){
+    return (fixed)floor((double)v * FX_ONE + 0.5);
+}
+
+float fx_to_float(fixed v){
+    return (float)v / FX_ONE;
+}
+
+// Q16.16 product: bits 16..47 of the 64-bit product. The vector versions
+// below compute exactly the same bits.
+fixed fx_mul(fixed a, fixed b){
+    return (fixed)(((Sint64)a * b) >> FX_SHIFT);
+}
+
+// Vector kernels over ball ranges. select_kernels() picks the widest set the
+// CPU supports once at startup; every set produces the same results as the
+// scalar one, given the contraction setting at the top of the file.
+typedef struct {
+    const char *name;
+    void (*integrate)(const BallArrays *b, int begin, int end, float dt, float gravity);
+    void (*walls)(const BallArrays *b, int begin, int end, float width, float height);
+    void (*walls_uniform)(const BallArrays *b, int begin, int end, float width, float height);
+    void (*narrowphase)(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out);
+    void (*narrowphase_uniform)(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out);
+    void (*solve)(const BallArrays *b, const ContactList *c, const int *order, int begin, int end);
+    void (*solve_uniform)(const BallArrays *b, const ContactList *c, const int *order, int begin, int end);
+    int solve_width;
+    void (*integrate_fixed)(const FixedArrays *f, int begin, int end, fixed dt, fixed gravity);
+    void (*walls_fixed)(const FixedArrays *f, int begin, int end, fixed width, fixed height);
+} Kernels;
+
+void integrate_scalar(const BallArrays *b, int begin, int end, float dt, float gravity){
+    for (int i = begin; i < end; i++){
+        b->vy[i] += gravity * dt;
+        b->x[i] += b->vx[i] * dt;
+        b->y[i] += b->vy[i] * dt;
+    }
+}
+
+// Clamps balls into the window and reflects their velocity with restitution
+// 1/2. A ball pushed off the top wall while moving slower than 1 px/s comes to
+// rest there. The vector versions apply the four walls in the same order
+// using compare masks instead of branches. The _uniform variants read one
+// radius for every ball.
+SDL_FORCE_INLINE void walls_scalar_body(const BallArrays *b, int begin, int end, float width, float height, int uniform){
+    float shared_r = uniform ? b->radius[0] : 0.0f;
+    for (int i = begin; i < end; i++){
+        float r = uniform ? shared_r : b->radius[i];
+        if (b->y[i] + r > height){
+            b->y[i] = height - r;
+            b->vy[i] *= -1/2.0f;
+        }
+        if (b->y[i] - r < 0){
+            b->y[i] = r;
+            if (b->vy[i] < 1) b->vy[i] = 0;
+            b->vy[i] *= -1/2.0f;
+        }
+
+        if (b->x[i] - r < 0){
+            b->x[i] = r;
+            b->vx[i] *= -1/2.0f;
+        }
+        if (b->x[i] + r > width){
+            b->x[i] = width - r;
+            b->vx[i] *= -1/2.0f;
+        }
+    }
+}
+
+void walls_scalar(const BallArrays *b, int begin, int end, float width, float height){
+    walls_scalar_body(b, begin, end, width, height, 0);
+}
+
+void walls_scalar_uniform(const BallArrays *b, int begin, int end, float width, float height){
+    walls_scalar_body(b, begin, end, width, height, 1);
+}
+
+#ifdef SDL_SSE2_INTRINSICS
+void SDL_TARGETING("sse2") integrate_sse2(const BallArrays *b, int begin, int end, float dt, float gravity){
+    __m128 vdt = _mm_set1_ps(dt);
+    __m128 dv = _mm_set1_ps(gravity * dt);
+    int i = begin;
+    for (; i + 4 <= end; i += 4){
+        __m128 vy = _mm_add_ps(_mm_loadu_ps(b->vy + i), dv);
+        _mm_storeu_ps(b->vy + i, vy);
+        _mm_storeu_ps(b->x + i, _mm_add_ps(_mm_loadu_ps(b->x + i), _mm_mul_ps(_mm_loadu_ps(b->vx + i), vdt)));
+        _mm_storeu_ps(b->y + i, _mm_add_ps(_mm_loadu_ps(b->y + i), _mm_mul_ps(vy, vdt)));
+    }
+    integrate_scalar(b, i, end, dt, gravity);
+}
+__m128 SDL_TARGETING("sse2") select_sse2(__m128 mask, __m128 a, __m128 b){
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+SDL_FORCE_INLINE void SDL_TARGETING("sse2") walls_sse2_body(const BallArrays *b, int begin, int end, float width, float height, int uniform){
+    __m128 shared_r = _mm_set1_ps(uniform ? b->radius[0] : 0.0f);
+    __m128 w = _mm_set1_ps(width);
+    __m128 h = _mm_set1_ps(height);
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 bounce = _mm_set1_ps(-1/2.0f);
+    int i = begin;
+    for (; i + 4 <= end; i += 4){
+        __m128 r = uniform ? shared_r : _mm_loadu_ps(b->radius + i);
+        __m128 x = _mm_loadu_ps(b->x + i);
+        __m128 y = _mm_loadu_ps(b->y + i);
+        __m128 vx = _mm_loadu_ps(b->vx + i);
+        __m128 vy = _mm_loadu_ps(b->vy + i);
+
+        __m128 m = _mm_cmpgt_ps(_mm_add_ps(y, r), h);
+        y = select_sse2(m, _mm_sub_ps(h, r), y);
+        vy = select_sse2(m, _mm_mul_ps(vy, bounce), vy);
+        m = _mm_cmplt_ps(_mm_sub_ps(y, r), zero);
+        y = select_sse2(m, r, y);
+        vy = select_sse2(m, _mm_mul_ps(select_sse2(_mm_cmplt_ps(vy, one), zero, vy), bounce), vy);
+
+        m = _mm_cmplt_ps(_mm_sub_ps(x, r), zero);
+        x = select_sse2(m, r, x);
+        vx = select_sse2(m, _mm_mul_ps(vx, bounce), vx);
+        m = _mm_cmpgt_ps(_mm_add_ps(x, r), w);
+        x = select_sse2(m, _mm_sub_ps(w, r), x);
+        vx = select_sse2(m, _mm_mul_ps(vx, bounce), vx);
+
+        _mm_storeu_ps(b->x + i, x);
+        _mm_storeu_ps(b->y + i, y);
+        _mm_storeu_ps(b->vx + i, vx);
+        _mm_storeu_ps(b->vy + i, vy);
+    }
+    walls_scalar_body(b, i, end, width, height, uniform);
+}
+
+void SDL_TARGETING("sse2") walls_sse2(const BallArrays *b, int begin, int end, float width, float height){
+    walls_sse2_body(b, begin, end, width, height, 0);
+}
+
+void SDL_TARGETING("sse2") walls_sse2_uniform(const BallArrays *b, int begin, int end, float width, float height){
+    walls_sse2_body(b, begin, end, width, height, 1);
+}
+#endif
+
+#ifdef SDL_AVX2_INTRINSICS
+void SDL_TARGETING("avx2") integrate_avx2(const BallArrays *b, int begin, int end, float dt, float gravity){
+    __m256 vdt = _mm256_set1_ps(dt);
+    __m256 dv = _mm256_set1_ps(gravity * dt);
+    int i = begin;
+    for (; i + 8 <= end; i += 8){
+        __m256 vy = _mm256_add_ps(_mm256_loadu_ps(b->vy + i), dv);
+        _mm256_storeu_ps(b->vy + i, vy);
+        _mm256_storeu_ps(b->x + i, _mm256_add_ps(_mm256_loadu_ps(b->x + i), _mm256_mul_ps(_mm256_loadu_ps(b->vx + i), vdt)));
+        _mm256_storeu_ps(b->y + i, _mm256_add_ps(_mm256_loadu_ps(b->y + i), _mm256_mul_ps(vy, vdt)));
+    }
+    integrate_scalar(b, i, end, dt, gravity);
+}
+SDL_FORCE_INLINE void SDL_TARGETING("avx2") walls_avx2_body(const BallArrays *b, int begin, int end, float width, float height, int uniform){
+    __m256 shared_r = _mm256_set1_ps(uniform ? b->radius[0] : 0.0f);
+    __m256 w = _mm256_set1_ps(width);
+    __m256 h = _mm256_set1_ps(height);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 bounce = _mm256_set1_ps(-1/2.0f);
+    int i = begin;
+    for (; i + 8 <= end; i += 8){
+        __m256 r = uniform ? shared_r : _mm256_loadu_ps(b->radius + i);
+        __m256 x = _mm256_loadu_ps(b->x + i);
+        __m256 y = _mm256_loadu_ps(b->y + i);
+        __m256 vx = _mm256_loadu_ps(b->vx + i);
+        __m256 vy = _mm256_loadu_ps(b->vy + i);
+
+        __m256 m = _mm256_cmp_ps(_mm256_add_ps(y, r), h, _CMP_GT_OQ);
+        y = _mm256_blendv_ps(y, _mm256_sub_ps(h, r), m);
+        vy = _mm256_blendv_ps(vy, _mm256_mul_ps(vy, bounce), m);
+        m = _mm256_cmp_ps(_mm256_sub_ps(y, r), zero, _CMP_LT_OQ);
+        y = _mm256_blendv_ps(y, r, m);
+        __m256 rest = _mm256_blendv_ps(vy, zero, _mm256_cmp_ps(vy, one, _CMP_LT_OQ));
+        vy = _mm256_blendv_ps(vy, _mm256_mul_ps(rest, bounce), m);
+
+        m = _mm256_cmp_ps(_mm256_sub_ps(x, r), zero, _CMP_LT_OQ);
+        x = _mm256_blendv_ps(x, r, m);
+        vx = _mm256_blendv_ps(vx, _mm256_mul_ps(vx, bounce), m);
+        m = _mm256_cmp_ps(_mm256_add_ps(x, r), w, _CMP_GT_OQ);
+        x = _mm256_blendv_ps(x, _mm256_sub_ps(w, r), m);
+        vx = _mm256_blendv_ps(vx, _mm256_mul_ps(vx, bounce), m);
+
+        _mm256_storeu_ps(b->x + i, x);
+        _mm256_storeu_ps(b->y + i, y);
+        _mm256_storeu_ps(b->vx + i, vx);
+        _mm256_storeu_ps(b->vy + i, vy);
+    }
+    walls_scalar_body(b, i, end, width, height, uniform);
+}
+
+void SDL_TARGETING("avx2") walls_avx2(const BallArrays *b, int begin, int end, float width, float height){
+    walls_avx2_body(b, begin, end, width, height, 0);
+}
+
+void SDL_TARGETING("avx2") walls_avx2_uniform(const BallArrays *b, int begin, int end, float width, float height){
+    walls_avx2_body(b, begin, end, width, height, 1);
+}
+#endif
+
+#ifdef SDL_NEON_INTRINSICS
+void integrate_neon(const BallArrays *b, int begin, int end, float dt, float gravity){
+    float32x4_t vdt = vdupq_n_f32(dt);
+    float32x4_t dv = vdupq_n_f32(gravity * dt);
+    int i = begin;
+    for (; i + 4 <= end; i += 4){
+        float32x4_t vy = vaddq_f32(vld1q_f32(b->vy + i), dv);
+        vst1q_f32(b->vy + i, vy);
+        vst1q_f32(b->x + i, vaddq_f32(vld1q_f32(b->x + i), vmulq_f32(vld1q_f32(b->vx + i), vdt)));
+        vst1q_f32(b->y + i, vaddq_f32(vld1q_f32(b->y + i), vmulq_f32(vy, vdt)));
+    }
+    integrate_scalar(b, i, end, dt, gravity);
+}
+SDL_FORCE_INLINE void walls_neon_body(const BallArrays *b, int begin, int end, float width, float height, int uniform){
+    float32x4_t shared_r = vdupq_n_f32(uniform ? b->radius[0] : 0.0f);
+    float32x4_t w = vdupq_n_f32(width);
+    float32x4_t h = vdupq_n_f32(height);
+    float32x4_t zero = vdupq_n_f32(0.0f);
+    float32x4_t one = vdupq_n_f32(1.0f);
+    float32x4_t bounce = vdupq_n_f32(-1/2.0f);
+    int i = begin;
+    for (; i + 4 <= end; i += 4){
+        float32x4_t r = uniform ? shared_r : vld1q_f32(b->radius + i);
+        float32x4_t x = vld1q_f32(b->x + i);
+        float32x4_t y = vld1q_f32(b->y + i);
+        float32x4_t vx = vld1q_f32(b->vx + i);
+        float32x4_t vy = vld1q_f32(b->vy + i);
+
+        uint32x4_t m = vcgtq_f32(vaddq_f32(y, r), h);
+        y = vbslq_f32(m, vsubq_f32(h, r), y);
+        vy = vbslq_f32(m, vmulq_f32(vy, bounce), vy);
+        m = vcltq_f32(vsubq_f32(y, r), zero);
+        y = vbslq_f32(m, r, y);
+        vy = vbslq_f32(m, vmulq_f32(vbslq_f32(vcltq_f32(vy, one), zero, vy), bounce), vy);
+
+        m = vcltq_f32(vsubq_f32(x, r), zero);
+        x = vbslq_f32(m, r, x);
+        vx = vbslq_f32(m, vmulq_f32(vx, bounce), vx);
+        m = vcgtq_f32(vaddq_f32(x, r), w);
+        x = vbslq_f32(m, vsubq_f32(w, r), x);
+        vx = vbslq_f32(m, vmulq_f32(vx, bounce), vx);
+
+        vst1q_f32(b->x + i, x);
+        vst1q_f32(b->y + i, y);
+        vst1q_f32(b->vx + i, vx);
+        vst1q_f32(b->vy + i, vy);
+    }
+    walls_scalar_body(b, i, end, width, height, uniform);
+}
+
+void walls_neon(const BallArrays *b, int begin, int end, float width, float height){
+    walls_neon_body(b, begin, end, width, height, 0);
+}
+
+void walls_neon_uniform(const BallArrays *b, int begin, int end, float width, float height){
+    walls_neon_body(b, begin, end, width, height, 1);
+}
+#endif
+
+#ifdef SDL_AVX512F_INTRINSICS
+// 16 lanes; the tail is handled with masked loads and stores instead of a
+// scalar loop.
+Uint16 lanes_avx512(int n){
+    return n >= 16 ? 0xFFFF : (Uint16)((1u << n) - 1);
+}
+
+// AVX-512F implies FMA, and compilers fuse a plain multiply into the add that
+// follows it, which rounds differently from the other kernel sets. The
+// explicit-rounding multiply is never fused.
+__m512 SDL_TARGETING("avx512f") mul_avx512(__m512 a, __m512 b){
+    return _mm512_mul_round_ps(a, b, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+
+void SDL_TARGETING("avx512f") integrate_avx512(const BallArrays *b, int begin, int end, float dt, float gravity){
+    __m512 vdt = _mm512_set1_ps(dt);
+    __m512 dv = _mm512_set1_ps(gravity * dt);
+    for (int i = begin; i < end; i += 16){
+        __mmask16 live = lanes_avx512(end - i);
+        __m512 vy = _mm512_add_ps(_mm512_maskz_loadu_ps(live, b->vy + i), dv);
+        _mm512_mask_storeu_ps(b->vy + i, live, vy);
+        _mm512_mask_storeu_ps(b->x + i, live, _mm512_add_ps(_mm512_maskz_loadu_ps(live, b->x + i), mul_avx512(_mm512_maskz_loadu_ps(live, b->vx + i), vdt)));
+        _mm512_mask_storeu_ps(b->y + i, live, _mm512_add_ps(_mm512_maskz_loadu_ps(live, b->y + i), mul_avx512(vy, vdt)));
+    }
+}
+
+SDL_FORCE_INLINE void SDL_TARGETING("avx512f") walls_avx512_body(const BallArrays *b, int begin, int end, float width, float height, int uniform){
+    __m512 shared_r = _mm512_set1_ps(uniform ? b->radius[0] : 0.0f);
+    __m512 w = _mm512_set1_ps(width);
+    __m512 h = _mm512_set1_ps(height);
+    __m512 zero = _mm512_setzero_ps();
+    __m512 one = _mm512_set1_ps(1.0f);
+    __m512 bounce = _mm512_set1_ps(-1/2.0f);
+    for (int i = begin; i < end; i += 16){
+        __mmask16 live = lanes_avx512(end - i);
+        __m512 r = uniform ? shared_r : _mm512_maskz_loadu_ps(live, b->radius + i);
+        __m512 x = _mm512_maskz_loadu_ps(live, b->x + i);
+        __m512 y = _mm512_maskz_loadu_ps(live, b->y + i);
+        __m512 vx = _mm512_maskz_loadu_ps(live, b->vx + i);
+        __m512 vy = _mm512_maskz_loadu_ps(live, b->vy + i);
+
+        __mmask16 m = _mm512_cmp_ps_mask(_mm512_add_ps(y, r), h, _CMP_GT_OQ);
+        y = _mm512_mask_sub_ps(y, m, h, r);
+        vy = _mm512_mask_mul_ps(vy, m, vy, bounce);
+        m = _mm512_cmp_ps_mask(_mm512_sub_ps(y, r), zero, _CMP_LT_OQ);
+        y = _mm512_mask_mov_ps(y, m, r);
+        __m512 rest = _mm512_mask_mov_ps(vy, _mm512_cmp_ps_mask(vy, one, _CMP_LT_OQ), zero);
+        vy = _mm512_mask_mul_ps(vy, m, rest, bounce);
+
+        m = _mm512_cmp_ps_mask(_mm512_sub_ps(x, r), zero, _CMP_LT_OQ);
+        x = _mm512_mask_mov_ps(x, m, r);
+        vx = _mm512_mask_mul_ps(vx, m, vx, bounce);
+        m = _mm512_cmp_ps_mask(_mm512_add_ps(x, r), w, _CMP_GT_OQ);
+        x = _mm512_mask_sub_ps(x, m, w, r);
+        vx = _mm512_mask_mul_ps(vx, m, vx, bounce);
+
+        _mm512_mask_storeu_ps(b->x + i, live, x);
+        _mm512_mask_storeu_ps(b->y + i, live, y);
+        _mm512_mask_storeu_ps(b->vx + i, live, vx);
+        _mm512_mask_storeu_ps(b->vy + i, live, vy);
+    }
+}
+
+void SDL_TARGETING("avx512f") walls_avx512(const BallArrays *b, int begin, int end, float width, float height){
+    walls_avx512_body(b, begin, end, width, height, 0);
+}
+
+void SDL_TARGETING("avx512f") walls_avx512_uniform(const BallArrays *b, int begin, int end, float width, float height){
+    walls_avx512_body(b, begin, end, width, height, 1);
+}
+#endif
+
+// Narrowphase: candidate pairs are rejected in squared distance against
+// (ri + rj)^2, several at a time; survivors get the exact test and are
+// appended to out, which must have room for count more contacts. The
+// _uniform variants use one contact distance for every pair.
+SDL_FORCE_INLINE void narrowphase_scalar_body(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out, int uniform){
+    float shared_reach = uniform ? b->radius[0] + b->radius[0] : 0.0f;
+    for (int p = 0; p < count; p++){
+        int i = pair_a[p];
+        int j = pair_b[p];
+        float dx = b->x[j] - b->x[i];
+        float dy = b->y[j] - b->y[i];
+        float reach = uniform ? shared_reach : b->radius[i] + b->radius[j];
+        if (dx * dx + dy * dy < reach * reach) narrowphase_emit(i, j, dx, dy, reach, out);
+    }
+}
+
+void narrowphase_scalar(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out){
+    narrowphase_scalar_body(b, pair_a, pair_b, count, out, 0);
+}
+
+void narrowphase_scalar_uniform(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out){
+    narrowphase_scalar_body(b, pair_a, pair_b, count, out, 1);
+}
+
+#ifdef SDL_SSE2_INTRINSICS
+SDL_FORCE_INLINE void SDL_TARGETING("sse2") narrowphase_sse2_body(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out, int uniform){
+    __m128 shared_reach = _mm_set1_ps(uniform ? b->radius[0] + b->radius[0] : 0.0f);
+    int p = 0;
+    for (; p + 4 <= count; p += 4){
+        const int *i = pair_a + p;
+        const int *j = pair_b + p;
+        __m128 dx = _mm_sub_ps(_mm_setr_ps(b->x[j[0]], b->x[j[1]], b->x[j[2]], b->x[j[3]]), _mm_setr_ps(b->x[i[0]], b->x[i[1]], b->x[i[2]], b->x[i[3]]));
+        __m128 dy = _mm_sub_ps(_mm_setr_ps(b->y[j[0]], b->y[j[1]], b->y[j[2]], b->y[j[3]]), _mm_setr_ps(b->y[i[0]], b->y[i[1]], b->y[i[2]], b->y[i[3]]));
+        __m128 reach = uniform ? shared_reach : _mm_add_ps(_mm_setr_ps(b->radius[i[0]], b->radius[i[1]], b->radius[i[2]], b->radius[i[3]]),
+                                                           _mm_setr_ps(b->radius[j[0]], b->radius[j[1]], b->radius[j[2]], b->radius[j[3]]));
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        int hits = _mm_movemask_ps(_mm_cmplt_ps(d2, _mm_mul_ps(reach, reach)));
+        if (!hits) continue;
+
+        float lane_dx[4], lane_dy[4], lane_reach[4];
+        _mm_storeu_ps(lane_dx, dx);
+        _mm_storeu_ps(lane_dy, dy);
+        _mm_storeu_ps(lane_reach, reach);
+        for (int lane = 0; lane < 4; lane++){
+            if (hits & (1 << lane)) narrowphase_emit(i[lane], j[lane], lane_dx[lane], lane_dy[lane], lane_reach[lane], out);
+        }
+    }
+    narrowphase_scalar_body(b, pair_a + p, pair_b + p, count - p, out, uniform);
+}
+
+void SDL_TARGETING("sse2") narrowphase_sse2(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out){
+    narrowphase_sse2_body(b, pair_a, pair_b, count, out, 0);
+}
+
+void SDL_TARGETING("sse2") narrowphase_sse2_uniform(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out){
+    narrowphase_sse2_body(b, pair_a, pair_b, count, out, 1);
+}
+#endif
+
+#ifdef SDL_AVX2_INTRINSICS
+SDL_FORCE_INLINE void SDL_TARGETING("avx2") narrowphase_avx2_body(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out, int uniform){
+    __m256 shared_reach = _mm256_set1_ps(uniform ? b->radius[0] + b->radius[0] : 0.0f);
+    int p = 0;
+    for (; p + 8 <= count; p += 8){
+        __m256i i = _mm256_loadu_si256((const __m256i *)(pair_a + p));
+        __m256i j = _mm256_loadu_si256((const __m256i *)(pair_b + p));
+        __m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(b->x, j, 4), _mm256_i32gather_ps(b->x, i, 4));
+        __m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(b->y, j, 4), _mm256_i32gather_ps(b->y, i, 4));
+        __m256 reach = uniform ? shared_reach : _mm256_add_ps(_mm256_i32gather_ps(b->radius, i, 4), _mm256_i32gather_ps(b->radius, j, 4));
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        int hits = _mm256_movemask_ps(_mm256_cmp_ps(d2, _mm256_mul_ps(reach, reach), _CMP_LT_OQ));
+        if (!hits) continue;
+
+        float lane_dx[8], lane_dy[8], lane_reach[8];
+        _mm256_storeu_ps(lane_dx, dx);
+        _mm256_storeu_ps(lane_dy, dy);
+        _mm256_storeu_ps(lane_reach, reach);
+        for (int lane = 0; lane < 8; lane++){
+            if (hits & (1 << lane)) narrowphase_emit(pair_a[p + lane], pair_b[p + lane], lane_dx[lane], lane_dy[lane], lane_reach[lane], out);
+        }
+    }
+    narrowphase_scalar_body(b, pair_a + p, pair_b + p, count - p, out, uniform);
+}
+
+void SDL_TARGETING("avx2") narrowphase_avx2(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out){
+    narrowphase_avx2_body(b, pair_a, pair_b, count, out, 0);
+}
+
+void SDL_TARGETING("avx2") narrowphase_avx2_uniform(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out){
+    narrowphase_avx2_body(b, pair_a, pair_b, count, out, 1);
+}
+#endif
+
+#ifdef SDL_NEON_INTRINSICS
+SDL_FORCE_INLINE void narrowphase_neon_body(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out, int uniform){
+    float32x4_t shared_reach = vdupq_n_f32(uniform ? b->radius[0] + b->radius[0] : 0.0f);
+    int p = 0;
+    for (; p + 4 <= count; p += 4){
+        const int *i = pair_a + p;
+        const int *j = pair_b + p;
+        float xi[4] = {b->x[i[0]], b->x[i[1]], b->x[i[2]], b->x[i[3]]};
+        float xj[4] = {b->x[j[0]], b->x[j[1]], b->x[j[2]], b->x[j[3]]};
+        float yi[4] = {b->y[i[0]], b->y[i[1]], b->y[i[2]], b->y[i[3]]};
+        float yj[4] = {b->y[j[0]], b->y[j[1]], b->y[j[2]], b->y[j[3]]};
+        float32x4_t dx = vsubq_f32(vld1q_f32(xj), vld1q_f32(xi));
+        float32x4_t dy = vsubq_f32(vld1q_f32(yj), vld1q_f32(yi));
+        float32x4_t reach = shared_reach;
+        if (!uniform){
+            float ri[4] = {b->radius[i[0]], b->radius[i[1]], b->radius[i[2]], b->radius[i[3]]};
+            float rj[4] = {b->radius[j[0]], b->radius[j[1]], b->radius[j[2]], b->radius[j[3]]};
+            reach = vaddq_f32(vld1q_f32(ri), vld1q_f32(rj));
+        }
+        float32x4_t d2 = vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy));
+        uint32x4_t hit = vcltq_f32(d2, vmulq_f32(reach, reach));
+        uint32x2_t any = vorr_u32(vget_low_u32(hit), vget_high_u32(hit));
+        if ((vget_lane_u32(any, 0) | vget_lane_u32(any, 1)) == 0) continue;
+
+        Uint32 lane_hit[4];
+        float lane_dx[4], lane_dy[4], lane_reach[4];
+        vst1q_u32(lane_hit, hit);
+        vst1q_f32(lane_dx, dx);
+        vst1q_f32(lane_dy, dy);
+        vst1q_f32(lane_reach, reach);
+        for (int lane = 0; lane < 4; lane++){
+            if (lane_hit[lane]) narrowphase_emit(i[lane], j[lane], lane_dx[lane], lane_dy[lane], lane_reach[lane], out);
+        }
+    }
+    narrowphase_scalar_body(b, pair_a + p, pair_b + p, count - p, out, uniform);
+}
+
+void narrowphase_neon(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out){
+    narrowphase_neon_body(b, pair_a, pair_b, count, out, 0);
+}
+
+void narrowphase_neon_uniform(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out){
+    narrowphase_neon_body(b, pair_a, pair_b, count, out, 1);
+}
+#endif
+
+#ifdef SDL_AVX512F_INTRINSICS
+// The exact test stays in the vector unit: the square root is taken in double
+// precision like the scalar sqrt() call, and the lanes that touch are
+// compressed straight into the contact list in pair order.
+SDL_FORCE_INLINE void SDL_TARGETING("avx512f") narrowphase_avx512_body(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out, int uniform){
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512d offset = _mm512_set1_pd(0.1f);
+    __m512 shared_reach = _mm512_set1_ps(uniform ? b->radius[0] + b->radius[0] : 0.0f);
+    for (int p = 0; p < count; p += 16){
+        __mmask16 live = lanes_avx512(count - p);
+        __m512i i = _mm512_maskz_loadu_epi32(live, pair_a + p);
+        __m512i j = _mm512_maskz_loadu_epi32(live, pair_b + p);
+        __m512 dx = _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, live, j, b->x, 4), _mm512_mask_i32gather_ps(zero, live, i, b->x, 4));
+        __m512 dy = _mm512_sub_ps(_mm512_mask_i32gather_ps(zero, live, j, b->y, 4), _mm512_mask_i32gather_ps(zero, live, i, b->y, 4));
+        __m512 reach = uniform ? shared_reach : _mm512_add_ps(_mm512_mask_i32gather_ps(zero, live, i, b->radius, 4), _mm512_mask_i32gather_ps(zero, live, j, b->radius, 4));
+        __m512 d2 = _mm512_add_ps(mul_avx512(dx, dx), mul_avx512(dy, dy));
+        __mmask16 hit = _mm512_mask_cmp_ps_mask(live, d2, mul_avx512(reach, reach), _CMP_LT_OQ);
+        if (!hit) continue;
+
+        __m256 d2_lo = _mm512_castps512_ps256(d2);
+        __m256 d2_hi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(d2), 1));
+        __m256 dist_lo = _mm512_cvtpd_ps(_mm512_add_pd(_mm512_sqrt_pd(_mm512_cvtps_pd(d2_lo)), offset));
+        __m256 dist_hi = _mm512_cvtpd_ps(_mm512_add_pd(_mm512_sqrt_pd(_mm512_cvtps_pd(d2_hi)), offset));
+        __m512 dist = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(_mm256_castps_pd(dist_lo)), _mm256_castps_pd(dist_hi), 1));
+        hit = _mm512_mask_cmp_ps_mask(hit, dist, reach, _CMP_LT_OQ);
+        if (!hit) continue;
+
+        __mmask16 coincident = _mm512_cmp_ps_mask(dx, zero, _CMP_EQ_OQ) & _mm512_cmp_ps_mask(dy, zero, _CMP_EQ_OQ);
+        dx = _mm512_mask_mov_ps(dx, coincident, dist);
+
+        int k = out->count;
+        _mm512_mask_compressstoreu_epi32(out->a + k, hit, i);
+        _mm512_mask_compressstoreu_epi32(out->b + k, hit, j);
+        _mm512_mask_compressstoreu_ps(out->nx + k, hit, _mm512_div_ps(dx, dist));
+        _mm512_mask_compressstoreu_ps(out->ny + k, hit, _mm512_div_ps(dy, dist));
+        _mm512_mask_compressstoreu_ps(out->depth + k, hit, _mm512_sub_ps(reach, dist));
+        for (Uint32 m = hit; m; m &= m - 1) out->count++;
+    }
+}
+
+void SDL_TARGETING("avx512f") narrowphase_avx512(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out){
+    narrowphase_avx512_body(b, pair_a, pair_b, count, out, 0);
+}
+
+void SDL_TARGETING("avx512f") narrowphase_avx512_uniform(const BallArrays *b, const int *pair_a, const int *pair_b, int count, ContactList *out){
+    narrowphase_avx512_body(b, pair_a, pair_b, count, out, 1);
+}
+#endif
+
+// Batched contact solvers: order[begin, end) holds whole batches from
+// batch_contacts(), or with order NULL the contacts [begin, end) themselves
+// share no ball (a colour from colour_contacts()). Either way no two lanes
+// touch the same ball and the lanes can be gathered, solved side by side and
+// scattered back in any order. Only whole vectors are solved; the caller
+// passes the tail to solve_contacts_scalar(), whose arithmetic these match.
+#ifdef SDL_SSE2_INTRINSICS
+SDL_FORCE_INLINE void SDL_TARGETING("sse2") solve_contacts_sse2_body(const BallArrays *b, const ContactList *c, const int *order, int begin, int end, int uniform){
+    const __m128 percent = _mm_set1_ps(0.5f);
+    const __m128 two = _mm_set1_ps(2.0f);
+
+    for (int n = begin; n + 4 <= end; n += 4){
+        int k[4];
+        for (int l = 0; l < 4; l++) k[l] = order ? order[n + l] : n + l;
+        int i[4] = {c->a[k[0]], c->a[k[1]], c->a[k[2]], c->a[k[3]]};
+        int j[4] = {c->b[k[0]], c->b[k[1]], c->b[k[2]], c->b[k[3]]};
+        __m128 depth = _mm_setr_ps(c->depth[k[0]], c->depth[k[1]], c->depth[k[2]], c->depth[k[3]]);
+        __m128 push_x = _mm_mul_ps(_mm_mul_ps(_mm_setr_ps(c->nx[k[0]], c->nx[k[1]], c->nx[k[2]], c->nx[k[3]]), depth), percent);
+        __m128 push_y = _mm_mul_ps(_mm_mul_ps(_mm_setr_ps(c->ny[k[0]], c->ny[k[1]], c->ny[k[2]], c->ny[k[3]]), depth), percent);
+        __m128 xi = _mm_sub_ps(_mm_setr_ps(b->x[i[0]], b->x[i[1]], b->x[i[2]], b->x[i[3]]), push_x);
+        __m128 yi = _mm_sub_ps(_mm_setr_ps(b->y[i[0]], b->y[i[1]], b->y[i[2]], b->y[i[3]]), push_y);
+        __m128 xj = _mm_add_ps(_mm_setr_ps(b->x[j[0]], b->x[j[1]], b->x[j[2]], b->x[j[3]]), push_x);
+        __m128 yj = _mm_add_ps(_mm_setr_ps(b->y[j[0]], b->y[j[1]], b->y[j[2]], b->y[j[3]]), push_y);
+        __m128 vxi = _mm_setr_ps(b->vx[i[0]], b->vx[i[1]], b->vx[i[2]], b->vx[i[3]]);
+        __m128 vyi = _mm_setr_ps(b->vy[i[0]], b->vy[i[1]], b->vy[i[2]], b->vy[i[3]]);
+        __m128 vxj = _mm_setr_ps(b->vx[j[0]], b->vx[j[1]], b->vx[j[2]], b->vx[j[3]]);
+        __m128 vyj = _mm_setr_ps(b->vy[j[0]], b->vy[j[1]], b->vy[j[2]], b->vy[j[3]]);
+
+        __m128 dx = _mm_sub_ps(xi, xj);
+        __m128 dy = _mm_sub_ps(yi, yj);
+        __m128 dot = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(vxi, vxj), dx), _mm_mul_ps(_mm_sub_ps(vyi, vyj), dy));
+        __m128 len2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m128 si, sj;
+        if (uniform) si = sj = _mm_div_ps(dot, len2);
+        else {
+            __m128 inv_i = _mm_setr_ps(b->inv_mass[i[0]], b->inv_mass[i[1]], b->inv_mass[i[2]], b->inv_mass[i[3]]);
+            __m128 inv_j = _mm_setr_ps(b->inv_mass[j[0]], b->inv_mass[j[1]], b->inv_mass[j[2]], b->inv_mass[j[3]]);
+            __m128 q = _mm_div_ps(_mm_mul_ps(two, dot), _mm_mul_ps(_mm_add_ps(inv_i, inv_j), len2));
+            si = _mm_mul_ps(inv_j, q);
+            sj = _mm_mul_ps(inv_i, q);
+        }
+        __m128 apart = _mm_cmpgt_ps(len2, _mm_setzero_ps());
+        si = _mm_and_ps(si, apart);
+        sj = _mm_and_ps(sj, apart);
+        vxi = _mm_sub_ps(vxi, _mm_mul_ps(dx, si));
+        vyi = _mm_sub_ps(vyi, _mm_mul_ps(dy, si));
+        vxj = _mm_add_ps(vxj, _mm_mul_ps(dx, sj));
+        vyj = _mm_add_ps(vyj, _mm_mul_ps(dy, sj));
+
+        float lane[8][4];
+        _mm_storeu_ps(lane[0], xi);
+        _mm_storeu_ps(lane[1], yi);
+        _mm_storeu_ps(lane[2], xj);
+        _mm_storeu_ps(lane[3], yj);
+        _mm_storeu_ps(lane[4], vxi);
+        _mm_storeu_ps(lane[5], vyi);
+        _mm_storeu_ps(lane[6], vxj);
+        _mm_storeu_ps(lane[7], vyj);
+        for (int l = 0; l < 4; l++){
+            b->x[i[l]] = lane[0][l];
+            b->y[i[l]] = lane[1][l];
+            b->x[j[l]] = lane[2][l];
+            b->y[j[l]] = lane[3][l];
+            b->vx[i[l]] = lane[4][l];
+            b->vy[i[l]] = lane[5][l];
+            b->vx[j[l]] = lane[6][l];
+            b->vy[j[l]] = lane[7][l];
+        }
+    }
+}
+
+void SDL_TARGETING("sse2") solve_contacts_sse2(const BallArrays *b, const ContactList *c, const int *order, int begin, int end){
+    solve_contacts_sse2_body(b, c, order, begin, end, 0);
+}
+
+void SDL_TARGETING("sse2") solve_contacts_sse2_uniform(const BallArrays *b, const ContactList *c, const int *order, int begin, int end){
+    solve_contacts_sse2_body(b, c, order, begin, end, 1);
+}
+#endif
+
+#ifdef SDL_AVX2_INTRINSICS
+SDL_FORCE_INLINE void SDL_TARGETING("avx2") solve_contacts_avx2_body(const BallArrays *b, const ContactList *c, const int *order, int begin, int end, int uniform){
+    const __m256 percent = _mm256_set1_ps(0.5f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+
+    for (int n = begin; n + 8 <= end; n += 8){
+        __m256i i, j;
+        __m256 nx, ny, depth;
+        if (order){
+            __m256i k = _mm256_loadu_si256((const __m256i *)(order + n));
+            i = _mm256_i32gather_epi32(c->a, k, 4);
+            j = _mm256_i32gather_epi32(c->b, k, 4);
+            nx = _mm256_i32gather_ps(c->nx, k, 4);
+            ny = _mm256_i32gather_ps(c->ny, k, 4);
+            depth = _mm256_i32gather_ps(c->depth, k, 4);
+        } else {
+            i = _mm256_loadu_si256((const __m256i *)(c->a + n));
+            j = _mm256_loadu_si256((const __m256i *)(c->b + n));
+            nx = _mm256_loadu_ps(c->nx + n);
+            ny = _mm256_loadu_ps(c->ny + n);
+            depth = _mm256_loadu_ps(c->depth + n);
+        }
+        __m256 push_x = _mm256_mul_ps(_mm256_mul_ps(nx, depth), percent);
+        __m256 push_y = _mm256_mul_ps(_mm256_mul_ps(ny, depth), percent);
+        __m256 xi = _mm256_sub_ps(_mm256_i32gather_ps(b->x, i, 4), push_x);
+        __m256 yi = _mm256_sub_ps(_mm256_i32gather_ps(b->y, i, 4), push_y);
+        __m256 xj = _mm256_add_ps(_mm256_i32gather_ps(b->x, j, 4), push_x);
+        __m256 yj = _mm256_add_ps(_mm256_i32gather_ps(b->y, j, 4), push_y);
+        __m256 vxi = _mm256_i32gather_ps(b->vx, i, 4);
+        __m256 vyi = _mm256_i32gather_ps(b->vy, i, 4);
+        __m256 vxj = _mm256_i32gather_ps(b->vx, j, 4);
+        __m256 vyj = _mm256_i32gather_ps(b->vy, j, 4);
+
+        __m256 dx = _mm256_sub_ps(xi, xj);
+        __m256 dy = _mm256_sub_ps(yi, yj);
+        __m256 dot = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(vxi, vxj), dx), _mm256_mul_ps(_mm256_sub_ps(vyi, vyj), dy));
+        __m256 len2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        __m256 si, sj;
+        if (uniform) si = sj = _mm256_div_ps(dot, len2);
+        else {
+            __m256 inv_i = _mm256_i32gather_ps(b->inv_mass, i, 4);
+            __m256 inv_j = _mm256_i32gather_ps(b->inv_mass, j, 4);
+            __m256 q = _mm256_div_ps(_mm256_mul_ps(two, dot), _mm256_mul_ps(_mm256_add_ps(inv_i, inv_j), len2));
+            si = _mm256_mul_ps(inv_j, q);
+            sj = _mm256_mul_ps(inv_i, q);
+        }
+        __m256 apart = _mm256_cmp_ps(len2, _mm256_setzero_ps(), _CMP_GT_OQ);
+        si = _mm256_and_ps(si, apart);
+        sj = _mm256_and_ps(sj, apart);
+        vxi = _mm256_sub_ps(vxi, _mm256_mul_ps(dx, si));
+        vyi = _mm256_sub_ps(vyi, _mm256_mul_ps(dy, si));
+        vxj = _mm256_add_ps(vxj, _mm256_mul_ps(dx, sj));
+        vyj = _mm256_add_ps(vyj, _mm256_mul_ps(dy, sj));
+
+        // AVX2 has no scatter
+        int li[8], lj[8];
+        float lane[8][8];
+        _mm256_storeu_si256((__m256i *)li, i);
+        _mm256_storeu_si256((__m256i *)lj, j);
+        _mm256_storeu_ps(lane[0], xi);
+        _mm256_storeu_ps(lane[1], yi);
+        _mm256_storeu_ps(lane[2], xj);
+        _mm256_storeu_ps(lane[3], yj);
+        _mm256_storeu_ps(lane[4], vxi);
+        _mm256_storeu_ps(lane[5], vyi);
+        _mm256_storeu_ps(lane[6], vxj);
+        _mm256_storeu_ps(lane[7], vyj);
+        for (int l = 0; l < 8; l++){
+            b->x[li[l]] = lane[0][l];
+            b->y[li[l]] = lane[1][l];
+            b->x[lj[l]] = lane[2][l];
+            b->y[lj[l]] = lane[3][l];
+            b->vx[li[l]] = lane[4][l];
+            b->vy[li[l]] = lane[5][l];
+            b->vx[lj[l]] = lane[6][l];
+            b->vy[lj[l]] = lane[7][l];
+        }
+    }
+}
+
+void SDL_TARGETING("avx2") solve_contacts_avx2(const BallArrays *b, const ContactList *c, const int *order, int begin, int end){
+    solve_contacts_avx2_body(b, c, order, begin, end, 0);
+}
+
+void SDL_TARGETING("avx2") solve_contacts_avx2_uniform(const BallArrays *b, const ContactList *c, const int *order, int begin, int end){
+    solve_contacts_avx2_body(b, c, order, begin, end, 1);
+}
+#endif
+
+#ifdef SDL_NEON_INTRINSICS
+SDL_FORCE_INLINE void solve_contacts_neon_body(const BallArrays *b, const ContactList *c, const int *order, int begin, int end, int uniform){
+    const float32x4_t percent = vdupq_n_f32(0.5f);
+    const float32x4_t two = vdupq_n_f32(2.0f);
+
+    for (int n = begin; n + 4 <= end; n += 4){
+        int k[4];
+        for (int l = 0; l < 4; l++) k[l] = order ? order[n + l] : n + l;
+        int i[4], j[4];
+        float lane[13][4];
+        for (int l = 0; l < 4; l++){
+            i[l] = c->a[k[l]];
+            j[l] = c->b[k[l]];
+            lane[10][l] = c->nx[k[l]];
+            lane[11][l] = c->ny[k[l]];
+            lane[12][l] = c->depth[k[l]];
+            lane[0][l] = b->x[i[l]];
+            lane[1][l] = b->y[i[l]];
+            lane[2][l] = b->x[j[l]];
+            lane[3][l] = b->y[j[l]];
+            lane[4][l] = b->vx[i[l]];
+            lane[5][l] = b->vy[i[l]];
+            lane[6][l] = b->vx[j[l]];
+            lane[7][l] = b->vy[j[l]];
+            if (!uniform){
+                lane[8][l] = b->inv_mass[i[l]];
+                lane[9][l] = b->inv_mass[j[l]];
+            }
+        }
+        float32x4_t depth = vld1q_f32(lane[12]);
+        float32x4_t push_x = vmulq_f32(vmulq_f32(vld1q_f32(lane[10]), depth), percent);
+        float32x4_t push_y = vmulq_f32(vmulq_f32(vld1q_f32(lane[11]), depth), percent);
+        float32x4_t xi = vsubq_f32(vld1q_f32(lane[0]), push_x);
+        float32x4_t yi = vsubq_f32(vld1q_f32(lane[1]), push_y);
+        float32x4_t xj = vaddq_f32(vld1q_f32(lane[2]), push_x);
+        float32x4_t yj = vaddq_f32(vld1q_f32(lane[3]), push_y);
+        float32x4_t vxi = vld1q_f32(lane[4]);
+        float32x4_t vyi = vld1q_f32(lane[5]);
+        float32x4_t vxj = vld1q_f32(lane[6]);
+        float32x4_t vyj = vld1q_f32(lane[7]);
+
+        float32x4_t dx = vsubq_f32(xi, xj);
+        float32x4_t dy = vsubq_f32(yi, yj);
+        float32x4_t dot = vaddq_f32(vmulq_f32(vsubq_f32(vxi, vxj), dx), vmulq_f32(vsubq_f32(vyi, vyj), dy));
+        float32x4_t len2 = vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy));
+        // ARMv7 NEON has no vector divide; divide lane by lane so the results
+        // match the scalar solver
+        float num[4], den[4], apart[4];
+        float32x4_t si, sj;
+        vst1q_f32(apart, len2);
+        if (uniform){
+            vst1q_f32(num, dot);
+            vst1q_f32(den, len2);
+            for (int l = 0; l < 4; l++) num[l] = apart[l] > 0 ? num[l] / den[l] : 0;
+            si = sj = vld1q_f32(num);
+        }
+        else {
+            float32x4_t inv_i = vld1q_f32(lane[8]);
+            float32x4_t inv_j = vld1q_f32(lane[9]);
+            vst1q_f32(num, vmulq_f32(two, dot));
+            vst1q_f32(den, vmulq_f32(vaddq_f32(inv_i, inv_j), len2));
+            for (int l = 0; l < 4; l++) num[l] = apart[l] > 0 ? num[l] / den[l] : 0;
+            float32x4_t q = vld1q_f32(num);
+            si = vmulq_f32(inv_j, q);
+            sj = vmulq_f32(inv_i, q);
+        }
+        vxi = vsubq_f32(vxi, vmulq_f32(dx, si));
+        vyi = vsubq_f32(vyi, vmulq_f32(dy, si));
+        vxj = vaddq_f32(vxj, vmulq_f32(dx, sj));
+        vyj = vaddq_f32(vyj, vmulq_f32(dy, sj));
+
+        vst1q_f32(lane[0], xi);
+        vst1q_f32(lane[1], yi);
+        vst1q_f32(lane[2], xj);
+        vst1q_f32(lane[3], yj);
+        vst1q_f32(lane[4], vxi);
+        vst1q_f32(lane[5], vyi);
+        vst1q_f32(lane[6], vxj);
+        vst1q_f32(lane[7], vyj);
+        for (int l = 0; l < 4; l++){
+            b->x[i[l]] = lane[0][l];
+            b->y[i[l]] = lane[1][l];
+            b->x[j[l]] = lane[2][l];
+            b->y[j[l]] = lane[3][l];
+            b->vx[i[l]] = lane[4][l];
+            b->vy[i[l]] = lane[5][l];
+            b->vx[j[l]] = lane[6][l];
+            b->vy[j[l]] = lane[7][l];
+        }
+    }
+}
+
+void solve_contacts_neon(const BallArrays *b, const ContactList *c, const int *order, int begin, int end){
+    solve_contacts_neon_body(b, c, order, begin, end, 0);
+}
+
+void solve_contacts_neon_uniform(const BallArrays *b, const ContactList *c, const int *order, int begin, int end){
+    solve_contacts_neon_body(b, c, order, begin, end, 1);
+}
+#endif
+
+#ifdef SDL_AVX512F_INTRINSICS
+SDL_FORCE_INLINE void SDL_TARGETING("avx512f") solve_contacts_avx512_body(const BallArrays *b, const ContactList *c, const int *order, int begin, int end, int uniform){
+    const __m512 percent = _mm512_set1_ps(0.5f);
+    const __m512 two = _mm512_set1_ps(2.0f);
+
+    for (int n = begin; n + 16 <= end; n += 16){
+        __m512i i, j;
+        __m512 nx, ny, depth;
+        if (order){
+            __m512i k = _mm512_loadu_si512(order + n);
+            i = _mm512_i32gather_epi32(k, c->a, 4);
+            j = _mm512_i32gather_epi32(k, c->b, 4);
+            nx = _mm512_i32gather_ps(k, c->nx, 4);
+            ny = _mm512_i32gather_ps(k, c->ny, 4);
+            depth = _mm512_i32gather_ps(k, c->depth, 4);
+        } else {
+            i = _mm512_loadu_si512(c->a + n);
+            j = _mm512_loadu_si512(c->b + n);
+            nx = _mm512_loadu_ps(c->nx + n);
+            ny = _mm512_loadu_ps(c->ny + n);
+            depth = _mm512_loadu_ps(c->depth + n);
+        }
+        __m512 push_x = mul_avx512(mul_avx512(nx, depth), percent);
+        __m512 push_y = mul_avx512(mul_avx512(ny, depth), percent);
+        __m512 xi = _mm512_sub_ps(_mm512_i32gather_ps(i, b->x, 4), push_x);
+        __m512 yi = _mm512_sub_ps(_mm512_i32gather_ps(i, b->y, 4), push_y);
+        __m512 xj = _mm512_add_ps(_mm512_i32gather_ps(j, b->x, 4), push_x);
+        __m512 yj = _mm512_add_ps(_mm512_i32gather_ps(j, b->y, 4), push_y);
+        __m512 vxi = _mm512_i32gather_ps(i, b->vx, 4);
+        __m512 vyi = _mm512_i32gather_ps(i, b->vy, 4);
+        __m512 vxj = _mm512_i32gather_ps(j, b->vx, 4);
+        __m512 vyj = _mm512_i32gather_ps(j, b->vy, 4);
+
+        __m512 dx = _mm512_sub_ps(xi, xj);
+        __m512 dy = _mm512_sub_ps(yi, yj);
+        __m512 dot = _mm512_add_ps(mul_avx512(_mm512_sub_ps(vxi, vxj), dx), mul_avx512(_mm512_sub_ps(vyi, vyj), dy));
+        __m512 len2 = _mm512_add_ps(mul_avx512(dx, dx), mul_avx512(dy, dy));
+        __m512 si, sj;
+        if (uniform) si = sj = _mm512_div_ps(dot, len2);
+        else {
+            __m512 inv_i = _mm512_i32gather_ps(i, b->inv_mass, 4);
+            __m512 inv_j = _mm512_i32gather_ps(j, b->inv_mass, 4);
+            __m512 q = _mm512_div_ps(mul_avx512(two, dot), mul_avx512(_mm512_add_ps(inv_i, inv_j), len2));
+            si = mul_avx512(inv_j, q);
+            sj = mul_avx512(inv_i, q);
+        }
+        __mmask16 apart = _mm512_cmp_ps_mask(len2, _mm512_setzero_ps(), _CMP_GT_OQ);
+        si = _mm512_maskz_mov_ps(apart, si);
+        sj = _mm512_maskz_mov_ps(apart, sj);
+        vxi = _mm512_sub_ps(vxi, mul_avx512(dx, si));
+        vyi = _mm512_sub_ps(vyi, mul_avx512(dy, si));
+        vxj = _mm512_add_ps(vxj, mul_avx512(dx, sj));
+        vyj = _mm512_add_ps(vyj, mul_avx512(dy, sj));
+
+        _mm512_i32scatter_ps(b->x, i, xi, 4);
+        _mm512_i32scatter_ps(b->y, i, yi, 4);
+        _mm512_i32scatter_ps(b->x, j, xj, 4);
+        _mm512_i32scatter_ps(b->y, j, yj, 4);
+        _mm512_i32scatter_ps(b->vx, i, vxi, 4);
+        _mm512_i32scatter_ps(b->vy, i, vyi, 4);
+        _mm512_i32scatter_ps(b->vx, j, vxj, 4);
+        _mm512_i32scatter_ps(b->vy, j, vyj, 4);
+    }
+}
+
+void SDL_TARGETING("avx512f") solve_contacts_avx512(const BallArrays *b, const ContactList *c, const int *order, int begin, int end){
+    solve_contacts_avx512_body(b, c, order, begin, end, 0);
+}
+
+void SDL_TARGETING("avx512f") solve_contacts_avx512_uniform(const BallArrays *b, const ContactList *c, const int *order, int begin, int end){
+    solve_contacts_avx512_body(b, c, order, begin, end, 1);
+}
+#endif
+
+// Fixed-point integration and walls. Halving a velocity is an arithmetic
+// shift, so it rounds toward minus infinity in every version.
+void integrate_fixed_scalar(const FixedArrays *f, int begin, int end, fixed dt, fixed gravity){
+    fixed dv = fx_mul(gravity, dt);
+    for (int i = begin; i < end; i++){
+        f->vy[i] += dv;
+        f->x[i] += fx_mul(f->vx[i], dt);
+        f->y[i] += fx_mul(f->vy[i], dt);
+    }
+}
+
+void walls_fixed_scalar(const FixedArrays *f, int begin, int end, fixed width, fixed height){
+    for (int i = begin; i < end; i++){
+        fixed r = f->radius[i];
+        if (f->y[i] + r > height){
+            f->y[i] = height - r;
+            f->vy[i] = -(f->vy[i] >> 1);
+        }
+        if (f->y[i] - r < 0){
+            f->y[i] = r;
+            if (f->vy[i] < FX_ONE) f->vy[i] = 0;
+            f->vy[i] = -(f->vy[i] >> 1);
+        }
+
+        if (f->x[i] - r < 0){
+            f->x[i] = r;
+            f->vx[i] = -(f->vx[i] >> 1);
+        }
+        if (f->x[i] + r > width){
+            f->x[i] = width - r;
+            f->vx[i] = -(f->vx[i] >> 1);
+        }
+    }
+}
+
+#ifdef SDL_SSE2_INTRINSICS
+// SSE2 only multiplies unsigned even lanes. The signed product differs from
+// the unsigned one by ((a < 0 ? b : 0) + (b < 0 ? a : 0)) << 32, which is
+// taken off at bit 16 of the result.
+__m128i SDL_TARGETING("sse2") fx_mul_sse2(__m128i a, __m128i b){
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    __m128i low_lanes = _mm_set_epi32(0, -1, 0, -1);
+    __m128i product = _mm_or_si128(_mm_and_si128(_mm_srli_epi64(even, FX_SHIFT), low_lanes),
+                                   _mm_andnot_si128(low_lanes, _mm_slli_epi64(odd, FX_SHIFT)));
+    __m128i correction = _mm_add_epi32(_mm_and_si128(_mm_srai_epi32(a, 31), b), _mm_and_si128(_mm_srai_epi32(b, 31), a));
+    return _mm_sub_epi32(product, _mm_slli_epi32(correction, FX_SHIFT));
+}
+
+__m128i SDL_TARGETING("sse2") select_epi32_sse2(__m128i mask, __m128i a, __m128i b){
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+__m128i SDL_TARGETING("sse2") fx_bounce_sse2(__m128i v){
+    return _mm_sub_epi32(_mm_setzero_si128(), _mm_srai_epi32(v, 1));
+}
+
+void SDL_TARGETING("sse2") integrate_fixed_sse2(const FixedArrays *f, int begin, int end, fixed dt, fixed gravity){
+    __m128i vdt = _mm_set1_epi32(dt);
+    __m128i dv = _mm_set1_epi32(fx_mul(gravity, dt));
+    int i = begin;
+    for (; i + 4 <= end; i += 4){
+        __m128i vy = _mm_add_epi32(_mm_loadu_si128((const __m128i *)(f->vy + i)), dv);
+        _mm_storeu_si128((__m128i *)(f->vy + i), vy);
+        _mm_storeu_si128((__m128i *)(f->x + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(f->x + i)), fx_mul_sse2(_mm_loadu_si128((const __m128i *)(f->vx + i)), vdt)));
+        _mm_storeu_si128((__m128i *)(f->y + i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(f->y + i)), fx_mul_sse2(vy, vdt)));
+    }
+    integrate_fixed_scalar(f, i, end, dt, gravity);
+}
+
+void SDL_TARGETING("sse2") walls_fixed_sse2(const FixedArrays *f, int begin, int end, fixed width, fixed height){
+    __m128i w = _mm_set1_epi32(width);
+    __m128i h = _mm_set1_epi32(height);
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi32(FX_ONE);
+    int i = begin;
+    for (; i + 4 <= end; i += 4){
+        __m128i r = _mm_loadu_si128((const __m128i *)(f->radius + i));
+        __m128i x = _mm_loadu_si128((const __m128i *)(f->x + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(f->y + i));
+        __m128i vx = _mm_loadu_si128((const __m128i *)(f->vx + i));
+        __m128i vy = _mm_loadu_si128((const __m128i *)(f->vy + i));
+
+        __m128i m = _mm_cmpgt_epi32(_mm_add_epi32(y, r), h);
+        y = select_epi32_sse2(m, _mm_sub_epi32(h, r), y);
+        vy = select_epi32_sse2(m, fx_bounce_sse2(vy), vy);
+        m = _mm_cmplt_epi32(_mm_sub_epi32(y, r), zero);
+        y = select_epi32_sse2(m, r, y);
+        vy = select_epi32_sse2(m, fx_bounce_sse2(select_epi32_sse2(_mm_cmplt_epi32(vy, one), zero, vy)), vy);
+
+        m = _mm_cmplt_epi32(_mm_sub_epi32(x, r), zero);
+        x = select_epi32_sse2(m, r, x);
+        vx = select_epi32_sse2(m, fx_bounce_sse2(vx), vx);
+        m = _mm_cmpgt_epi32(_mm_add_epi32(x, r), w);
+        x = select_epi32_sse2(m, _mm_sub_epi32(w, r), x);
+        vx = select_epi32_sse2(m, fx_bounce_sse2(vx), vx);
+
+        _mm_storeu_si128((__m128i *)(f->x + i), x);
+        _mm_storeu_si128((__m128i *)(f->y + i), y);
+        _mm_storeu_si128((__m128i *)(f->vx + i), vx);
+        _mm_storeu_si128((__m128i *)(f->vy + i), vy);
+    }
+    walls_fixed_scalar(f, i, end, width, height);
+}
+#endif
+
+#ifdef SDL_AVX2_INTRINSICS
+__m256i SDL_TARGETING("avx2") fx_mul_avx2(__m256i a, __m256i b){
+    __m256i even = _mm256_mul_epi32(a, b);
+    __m256i odd = _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+    return _mm256_blend_epi32(_mm256_srli_epi64(even, FX_SHIFT), _mm256_slli_epi64(odd, FX_SHIFT), 0xAA);
+}
+
+__m256i SDL_TARGETING("avx2") fx_bounce_avx2(__m256i v){
+    return _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_srai_epi32(v, 1));
+}
+
+void SDL_TARGETING("avx2") integrate_fixed_avx2(const FixedArrays *f, int begin, int end, fixed dt, fixed gravity){
+    __m256i vdt = _mm256_set1_epi32(dt);
+    __m256i dv = _mm256_set1_epi32(fx_mul(gravity, dt));
+    int i = begin;
+    for (; i + 8 <= end; i += 8){
+        __m256i vy = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(f->vy + i)), dv);
+        _mm256_storeu_si256((__m256i *)(f->vy + i), vy);
+        _mm256_storeu_si256((__m256i *)(f->x + i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(f->x + i)), fx_mul_avx2(_mm256_loadu_si256((const __m256i *)(f->vx + i)), vdt)));
+        _mm256_storeu_si256((__m256i *)(f->y + i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(f->y + i)), fx_mul_avx2(vy, vdt)));
+    }
+    integrate_fixed_scalar(f, i, end, dt, gravity);
+}
+
+void SDL_TARGETING("avx2") walls_fixed_avx2(const FixedArrays *f, int begin, int end, fixed width, fixed height){
+    __m256i w = _mm256_set1_epi32(width);
+    __m256i h = _mm256_set1_epi32(height);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i one = _mm256_set1_epi32(FX_ONE);
+    int i = begin;
+    for (; i + 8 <= end; i += 8){
+        __m256i r = _mm256_loadu_si256((const __m256i *)(f->radius + i));
+        __m256i x = _mm256_loadu_si256((const __m256i *)(f->x + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(f->y + i));
+        __m256i vx = _mm256_loadu_si256((const __m256i *)(f->vx + i));
+        __m256i vy = _mm256_loadu_si256((const __m256i *)(f->vy + i));
+
+        __m256i m = _mm256_cmpgt_epi32(_mm256_add_epi32(y, r), h);
+        y = _mm256_blendv_epi8(y, _mm256_sub_epi32(h, r), m);
+        vy = _mm256_blendv_epi8(vy, fx_bounce_avx2(vy), m);
+        m = _mm256_cmpgt_epi32(zero, _mm256_sub_epi32(y, r));
+        y = _mm256_blendv_epi8(y, r, m);
+        __m256i rest = _mm256_blendv_epi8(vy, zero, _mm256_cmpgt_epi32(one, vy));
+        vy = _mm256_blendv_epi8(vy, fx_bounce_avx2(rest), m);
+
+        m = _mm256_cmpgt_epi32(zero, _mm256_sub_epi32(x, r));
+        x = _mm256_blendv_epi8(x, r, m);
+        vx = _mm256_blendv_epi8(vx, fx_bounce_avx2(vx), m);
+        m = _mm256_cmpgt_epi32(_mm256_add_epi32(x, r), w);
+        x = _mm256_blendv_epi8(x, _mm256_sub_epi32(w, r), m);
+        vx = _mm256_blendv_epi8(vx, fx_bounce_avx2(vx), m);
+
+        _mm256_storeu_si256((__m256i *)(f->x + i), x);
+        _mm256_storeu_si256((__m256i *)(f->y + i), y);
+        _mm256_storeu_si256((__m256i *)(f->vx + i), vx);
+        _mm256_storeu_si256((__m256i *)(f->vy + i), vy);
+    }
+    walls_fixed_scalar(f, i, end, width, height);
+}
+#endif
+
+#ifdef SDL_NEON_INTRINSICS
+int32x4_t fx_mul_neon(int32x4_t a, int32x4_t b){
+    int32x2_t low = vshrn_n_s64(vmull_s32(vget_low_s32(a), vget_low_s32(b)), FX_SHIFT);
+    int32x2_t high = vshrn_n_s64(vmull_s32(vget_high_s32(a), vget_high_s32(b)), FX_SHIFT);
+    return vcombine_s32(low, high);
+}
+
+int32x4_t fx_bounce_neon(int32x4_t v){
+    return vnegq_s32(vshrq_n_s32(v, 1));
+}
+
+void integrate_fixed_neon(const FixedArrays *f, int begin, int end, fixed dt, fixed gravity){
+    int32x4_t vdt = vdupq_n_s32(dt);
+    int32x4_t dv = vdupq_n_s32(fx_mul(gravity, dt));
+    int i = begin;
+    for (; i + 4 <= end; i += 4){
+        int32x4_t vy = vaddq_s32(vld1q_s32(f->vy + i), dv);
+        vst1q_s32(f->vy + i, vy);
+        vst1q_s32(f->x + i, vaddq_s32(vld1q_s32(f->x + i), fx_mul_neon(vld1q_s32(f->vx + i), vdt)));
+        vst1q_s32(f->y + i, vaddq_s32(vld1q_s32(f->y + i), fx_mul_neon(vy, vdt)));
+    }
+    integrate_fixed_scalar(f, i, end, dt, gravity);
+}
+
+void walls_fixed_neon(const FixedArrays *f, int begin, int end, fixed width, fixed height){
+    int32x4_t w = vdupq_n_s32(width);
+    int32x4_t h = vdupq_n_s32(height);
+    int32x4_t zero = vdupq_n_s32(0);
+    int32x4_t one = vdupq_n_s32(FX_ONE);
+    int i = begin;
+    for (; i + 4 <= end; i += 4){
+        int32x4_t r = vld1q_s32(f->radius + i);
+        int32x4_t x = vld1q_s32(f->x + i);
+        int32x4_t y = vld1q_s32(f->y + i);
+        int32x4_t vx = vld1q_s32(f->vx + i);
+        int32x4_t vy = vld1q_s32(f->vy + i);
+
+        uint32x4_t m = vcgtq_s32(vaddq_s32(y, r), h);
+        y = vbslq_s32(m, vsubq_s32(h, r), y);
+        vy = vbslq_s32(m, fx_bounce_neon(vy), vy);
+        m = vcltq_s32(vsubq_s32(y, r), zero);
+        y = vbslq_s32(m, r, y);
+        vy = vbslq_s32(m, fx_bounce_neon(vbslq_s32(vcltq_s32(vy, one), zero, vy)), vy);
+
+        m = vcltq_s32(vsubq_s32(x, r), zero);
+        x = vbslq_s32(m, r, x);
+        vx = vbslq_s32(m, fx_bounce_neon(vx), vx);
+        m = vcgtq_s32(vaddq_s32(x, r), w);
+        x = vbslq_s32(m, vsubq_s32(w, r), x);
+        vx = vbslq_s32(m, fx_bounce_neon(vx), vx);
+
+        vst1q_s32(f->x + i, x);
+        vst1q_s32(f->y + i, y);
+        vst1q_s32(f->vx + i, vx);
+        vst1q_s32(f->vy + i, vy);
+    }
+    walls_fixed_scalar(f, i, end, width, height);
+}
+#endif
+
+#ifdef SDL_AVX512F_INTRINSICS
+__m512i SDL_TARGETING("avx512f") fx_mul_avx512(__m512i a, __m512i b){
+    __m512i even = _mm512_mul_epi32(a, b);
+    __m512i odd = _mm512_mul_epi32(_mm512_srli_epi64(a, 32), _mm512_srli_epi64(b, 32));
+    return _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(even, FX_SHIFT), _mm512_slli_epi64(odd, FX_SHIFT));
+}
+
+__m512i SDL_TARGETING("avx512f") fx_bounce_avx512(__m512i v){
+    return _mm512_sub_epi32(_mm512_setzero_si512(), _mm512_srai_epi32(v, 1));
+}
+
+void SDL_TARGETING("avx512f") integrate_fixed_avx512(const FixedArrays *f, int begin, int end, fixed dt, fixed gravity){
+    __m512i vdt = _mm512_set1_epi32(dt);
+    __m512i dv = _mm512_set1_epi32(fx_mul(gravity, dt));
+    for (int i = begin; i < end; i += 16){
+        __mmask16 live = lanes_avx512(end - i);
+        __m512i vy = _mm512_add_epi32(_mm512_maskz_loadu_epi32(live, f->vy + i), dv);
+        _mm512_mask_storeu_epi32(f->vy + i, live, vy);
+        _mm512_mask_storeu_epi32(f->x + i, live, _mm512_add_epi32(_mm512_maskz_loadu_epi32(live, f->x + i), fx_mul_avx512(_mm512_maskz_loadu_epi32(live, f->vx + i), vdt)));
+        _mm512_mask_storeu_epi32(f->y + i, live, _mm512_add_epi32(_mm512_maskz_loadu_epi32(live, f->y + i), fx_mul_avx512(vy, vdt)));
+    }
+}
+
+void SDL_TARGETING("avx512f") walls_fixed_avx512(const FixedArrays *f, int begin, int end, fixed width, fixed height){
+    __m512i w = _mm512_set1_epi32(width);
+    __m512i h = _mm512_set1_epi32(height);
+    __m512i zero = _mm512_setzero_si512();
+    __m512i one = _mm512_set1_epi32(FX_ONE);
+    for (int i = begin; i < end; i += 16){
+        __mmask16 live = lanes_avx512(end - i);
+        __m512i r = _mm512_maskz_loadu_epi32(live, f->radius + i);
+        __m512i x = _mm512_maskz_loadu_epi32(live, f->x + i);
+        __m512i y = _mm512_maskz_loadu_epi32(live, f->y + i);
+        __m512i vx = _mm512_maskz_loadu_epi32(live, f->vx + i);
+        __m512i vy = _mm512_maskz_loadu_epi32(live, f->vy + i);
+
+        __mmask16 m = _mm512_cmpgt_epi32_mask(_mm512_add_epi32(y, r), h);
+        y = _mm512_mask_sub_epi32(y, m, h, r);
+        vy = _mm512_mask_mov_epi32(vy, m, fx_bounce_avx512(vy));
+        m = _mm512_cmplt_epi32_mask(_mm512_sub_epi32(y, r), zero);
+        y = _mm512_mask_mov_epi32(y, m, r);
+        __m512i rest = _mm512_mask_mov_epi32(vy, _mm512_cmplt_epi32_mask(vy, one), zero);
+        vy = _mm512_mask_mov_epi32(vy, m, fx_bounce_avx512(rest));
+
+        m = _mm512_cmplt_epi32_mask(_mm512_sub_epi32(x, r), zero);
+        x = _mm512_mask_mov_epi32(x, m, r);
+        vx = _mm512_mask_mov_epi32(vx, m, fx_bounce_avx512(vx));
+        m = _mm512_cmpgt_epi32_mask(_mm512_add_epi32(x, r), w);
+        x = _mm512_mask_sub_epi32(x, m, w, r);
+        vx = _mm512_mask_mov_epi32(vx, m, fx_bounce_avx512(vx));
+
+        _mm512_mask_storeu_epi32(f->x + i, live, x);
+        _mm512_mask_storeu_epi32(f->y + i, live, y);
+        _mm512_mask_storeu_epi32(f->vx + i, live, vx);
+        _mm512_mask_storeu_epi32(f->vy + i, live, vy);
+    }
+}
+#endif
+
+const Kernels kernels_scalar = {"scalar", integrate_scalar, walls_scalar, walls_scalar_uniform, narrowphase_scalar, narrowphase_scalar_uniform,
+                                solve_contacts_scalar, solve_contacts_scalar_uniform, 1, integrate_fixed_scalar, walls_fixed_scalar};
+#ifdef SDL_SSE2_INTRINSICS
+const Kernels kernels_sse2 = {"SSE2", integrate_sse2, walls_sse2, walls_sse2_uniform, narrowphase_sse2, narrowphase_sse2_uniform,
+                              solve_contacts_sse2, solve_contacts_sse2_uniform, 4, integrate_fixed_sse2, walls_fixed_sse2};
+#endif
+#ifdef SDL_AVX2_INTRINSICS
+const Kernels kernels_avx2 = {"AVX2", integrate_avx2, walls_avx2, walls_avx2_uniform, narrowphase_avx2, narrowphase_avx2_uniform,
+                              solve_contacts_avx2, solve_contacts_avx2_uniform, 8, integrate_fixed_avx2, walls_fixed_avx2};
+#endif
+#ifdef SDL_NEON_INTRINSICS
+const Kernels kernels_neon = {"NEON", integrate_neon, walls_neon, walls_neon_uniform, narrowphase_neon, narrowphase_neon_uniform,
+                              solve_contacts_neon, solve_contacts_neon_uniform, 4, integrate_fixed_neon, walls_fixed_neon};
+#endif
+#ifdef SDL_AVX512F_INTRINSICS
+const Kernels kernels_avx512 = {"AVX-512", integrate_avx512, walls_avx512, walls_avx512_uniform, narrowphase_avx512, narrowphase_avx512_uniform,
+                                solve_contacts_avx512, solve_contacts_avx512_uniform, 16, integrate_fixed_avx512, walls_fixed_avx512};
+#endif
+
+Kernels kernels = {"scalar", integrate_scalar, walls_scalar, walls_scalar_uniform, narrowphase_scalar, narrowphase_scalar_uniform,
+                   solve_contacts_scalar, solve_contacts_scalar_uniform, 1, integrate_fixed_scalar, walls_fixed_scalar};
+
+void select_kernels(void){
+    kernels = kernels_scalar;
+#ifdef SDL_NEON_INTRINSICS
+    if (SDL_HasNEON()) kernels = kernels_neon;
+#endif
+#ifdef SDL_SSE2_INTRINSICS
+    if (SDL_HasSSE2()) kernels = kernels_sse2;
+#endif
+#ifdef SDL_AVX2_INTRINSICS
+    if (SDL_HasAVX2()) kernels = kernels_avx2;
+#endif
+#ifdef SDL_AVX512F_INTRINSICS
+    if (SDL_HasAVX512F()) kernels = kernels_avx512;
+#endif
+}
+
+// Integration and walls touch only their own ball, so each chunk runs both
+// back to back while its balls are in cache. Chunks are a multiple of 16
+// balls and the arrays are cache-line aligned, so no two workers ever write
+// the same line.
+#define MOTION_CHUNK 4096
+
+typedef struct {
+    float dt;
+    float gravity;
+    void (*walls)(const BallArrays *b, int begin, int end, float width, float height);
+} MotionPhase;
+
+void motion_task(void *data, int begin, int end, int worker){
+    const MotionPhase *m = data;
+    (void)worker;
+    kernels.integrate(&balls, begin, end, m->dt, m->gravity);
+    m->walls(&balls, begin, end, WINDOW_WIDTH, WINDOW_HEIGHT);
+}
+
+// Coloured solve: each colour is one parallel_for over its contiguous range.
+// SOLVE_CHUNK is a multiple of every vector width, so chunks split no vector.
+#define SOLVE_CHUNK 1024
+
+typedef struct {
+    const ContactList *contacts;
+    int begin;
+    int uniform;
+} ColourPhase;
+
+void colour_solve_task(void *data, int begin, int end, int worker){
+    const ColourPhase *phase = data;
+    (void)worker;
+    begin += phase->begin;
+    end += phase->begin;
+    int whole = begin + (end - begin) / kernels.solve_width * kernels.solve_width;
+    (phase->uniform ? kernels.solve_uniform : kernels.solve)(&balls, phase->contacts, NULL, begin, whole);
+    (phase->uniform ? solve_contacts_scalar_uniform : solve_contacts_scalar)(&balls, phase->contacts, NULL, whole, end);
+}
+
+void solve_coloured(ContactColouring *cc, int uniform){
+    for (int colour = 0; colour < cc->colour_count; colour++){
+        ColourPhase phase = {&cc->sorted, cc->start[colour], uniform};
+        parallel_for(colour_solve_task, &phase, cc->start[colour + 1] - cc->start[colour], SOLVE_CHUNK);
+    }
+    (uniform ? solve_contacts_scalar_uniform : solve_contacts_scalar)(&balls, &cc->sorted, NULL, cc->start[CONTACT_COLOURS], cc->sorted.count);
+}
+
+// Jacobi solve: every contact works out its push and impulse from the state
+// at the start of the solve, then every ball adds up the deltas of its
+// contacts in contact order, found through a per-ball (CSR) list. Neither pass
+// writes anything another worker reads, so the result is the same for any
+// worker count. Summed in full, the impulses of a ball with several contacts
+// overshoot and a pile blows up, so each contact is scaled by one over the
+// larger contact count of its two balls (mass splitting); an isolated pair is
+// solved exactly as by the sequential solver. Contacts do not see each
+// other's corrections within a step, so piles settle more slowly.
+typedef struct {
+    const ContactList *contacts;
+    int uniform;
+    float *push_x, *push_y;     // subtracted from ball a, added to ball b
+    float *dv_ax, *dv_ay;       // subtracted from ball a's velocity
+    float *dv_bx, *dv_by;       // added to ball b's velocity
+    int contact_capacity;
+    int *ball_start;            // ball i's entries are [ball_start[i], ball_start[i + 1])
+    int start_capacity;
+    int *entry;                 // contact * 2, + 1 where the ball is b
+    int entry_capacity;
+} JacobiSolver;
+
+JacobiSolver jacobi;
+
+void jacobi_reserve(JacobiSolver *js, int contact_count){
+    if (js->contact_capacity < contact_count){
+        js->contact_capacity = contact_count + contact_count / 2;
+        js->push_x = realloc(js->push_x, js->contact_capacity * sizeof(float));
+        js->push_y = realloc(js->push_y, js->contact_capacity * sizeof(float));
+        js->dv_ax = realloc(js->dv_ax, js->contact_capacity * sizeof(float));
+        js->dv_ay = realloc(js->dv_ay, js->contact_capacity * sizeof(float));
+        js->dv_bx = realloc(js->dv_bx, js->contact_capacity * sizeof(float));
+        js->dv_by = realloc(js->dv_by, js->contact_capacity * sizeof(float));
+    }
+    if (js->entry_capacity < contact_count * 2){
+        js->entry_capacity = contact_count * 3;
+        js->entry = realloc(js->entry, js->entry_capacity * sizeof(int));
+    }
+    if (js->start_capacity < ball_count + 1){
+        js->start_capacity = ball_capacity + 1;
+        js->ball_start = realloc(js->ball_start, js->start_capacity * sizeof(int));
+    }
+}
+
+// Counting sort of the contact ends by ball. Filling from the last contact
+// down leaves every ball's entries in ascending contact order.
+void jacobi_build(JacobiSolver *js, const ContactList *c){
+    int *start = js->ball_start;
+    memset(start, 0, (ball_count + 1) * sizeof(int));
+    for (int k = 0; k < c->count; k++){
+        start[c->a[k]]++;
+        start[c->b[k]]++;
+    }
+    int sum = 0;
+    for (int i = 0; i <= ball_count; i++){
+        sum += start[i];
+        start[i] = sum;
+    }
+    for (int k = c->count - 1; k >= 0; k--){
+        js->entry[--start[c->a[k]]] = k * 2;
+        js->entry[--start[c->b[k]]] = k * 2 + 1;
+    }
+}
+
+// Same arithmetic as solve_contacts_scalar(), against the unsolved state.
+void jacobi_contact_task(void *data, int begin, int end, int worker){
+    JacobiSolver *js = data;
+    const ContactList *c = js->contacts;
+    const BallArrays *b = &balls;
+    const int *start = js->ball_start;
+    float percent = 0.5f;
+    (void)worker;
+
+    for (int k = begin; k < end; k++){
+        int i = c->a[k];
+        int j = c->b[k];
+        float share = 1.0f / (float)SDL_max(start[i + 1] - start[i], start[j + 1] - start[j]);
+        float push_x = c->nx[k] * c->depth[k] * percent;
+        float push_y = c->ny[k] * c->depth[k] * percent;
+        float dx = (b->x[i] - push_x) - (b->x[j] + push_x);
+        float dy = (b->y[i] - push_y) - (b->y[j] + push_y);
+        float dot = (b->vx[i] - b->vx[j]) * dx + (b->vy[i] - b->vy[j]) * dy;
+        float len2 = dx * dx + dy * dy;
+        float si = 0, sj = 0;
+        if (len2 > 0 && js->uniform) si = sj = dot / len2;
+        else if (len2 > 0){
+            float q = 2.0f * dot / ((b->inv_mass[i] + b->inv_mass[j]) * len2);
+            si = b->inv_mass[j] * q;
+            sj = b->inv_mass[i] * q;
+        }
+        js->push_x[k] = push_x * share;
+        js->push_y[k] = push_y * share;
+        js->dv_ax[k] = dx * si * share;
+        js->dv_ay[k] = dy * si * share;
+        js->dv_bx[k] = dx * sj * share;
+        js->dv_by[k] = dy * sj * share;
+    }
+}
+
+void jacobi_ball_task(void *data, int begin, int end, int worker){
+    const JacobiSolver *js = data;
+    const BallArrays *b = &balls;
+    (void)worker;
+
+    for (int i = begin; i < end; i++){
+        int first = js->ball_start[i], last = js->ball_start[i + 1];
+        if (first == last) continue;
+        float x = b->x[i], y = b->y[i], vx = b->vx[i], vy = b->vy[i];
+        for (int e = first; e < last; e++){
+            int k = js->entry[e] >> 1;
+            if (js->entry[e] & 1){
+                x += js->push_x[k];
+                y += js->push_y[k];
+                vx += js->dv_bx[k];
+                vy += js->dv_by[k];
+            } else {
+                x -= js->push_x[k];
+                y -= js->push_y[k];
+                vx -= js->dv_ax[k];
+                vy -= js->dv_ay[k];
+            }
+        }
+        b->x[i] = x;
+        b->y[i] = y;
+        b->vx[i] = vx;
+        b->vy[i] = vy;
+    }
+}
+
+void solve_jacobi(JacobiSolver *js, const ContactList *c, int uniform){
+    jacobi_reserve(js, c->count);
+    jacobi_build(js, c);
+    js->contacts = c;
+    js->uniform = uniform;
+    parallel_for(jacobi_contact_task, js, c->count, SOLVE_CHUNK);
+    parallel_for(jacobi_ball_task, js, ball_count, SOLVE_CHUNK);
+}
+
+// Contact islands: the balls joined through contacts, which no contact of
+// another island touches, so every island can be solved by its own task. A
+// lock-free union-find over the contacts finds them each step. Each island's
+// contacts are solved in their original order, so the result is bit for bit
+// that of the sequential solver; consecutive islands are packed into one task
+// until it holds ISLAND_BATCH_CONTACTS contacts. One big pile is one island
+// and gets no parallelism.
+#define ISLAND_BATCH_CONTACTS 256
+
+typedef struct {
+    const ContactList *contacts;
+    int uniform;
+    SDL_AtomicInt *parent;  // always a lower index, so a root is its island's lowest ball
+    int *root;
+    int *island_of;         // island of each root ball, -1 for none
+    int ball_capacity;
+    int *order;             // contacts grouped by island
+    int order_capacity;
+    int *start;             // island i's contacts are order[start[i], start[i + 1])
+    int *ball_total;        // filled by print_island_stats()
+    int island_capacity;
+    int island_count;
+    int task_count;
+    int built_ball_count;   // balls when the islands were built
+} ContactIslands;
+
+ContactIslands islands;
+
+void islands_reserve(ContactIslands *is, int contact_count){
+    if (is->ball_capacity < ball_count){
+        is->ball_capacity = ball_capacity;
+        is->parent = realloc(is->parent, is->ball_capacity * sizeof(SDL_AtomicInt));
+        is->root = realloc(is->root, is->ball_capacity * sizeof(int));
+        is->island_of = realloc(is->island_of, is->ball_capacity * sizeof(int));
+    }
+    if (is->order_capacity < contact_count){
+        is->order_capacity = contact_count + contact_count / 2;
+        is->order = realloc(is->order, is->order_capacity * sizeof(int));
+    }
+    if (is->island_capacity < contact_count + 1){
+        is->island_capacity = contact_count + contact_count / 2 + 1;
+        is->start = realloc(is->start, is->island_capacity * sizeof(int));
+        is->ball_total = realloc(is->ball_total, is->island_capacity * sizeof(int));
+    }
+}
+
+// Halves the path on the way up; parents only ever move to an ancestor, so a
+// failed CAS just means another worker got there first.
+int island_find(SDL_AtomicInt *parent, int x){
+    for (;;){
+        int p = SDL_GetAtomicInt(&parent[x]);
+        if (p == x) return x;
+        int grandparent = SDL_GetAtomicInt(&parent[p]);
+        if (grandparent != p) SDL_CompareAndSwapAtomicInt(&parent[x], p, grandparent);
+        x = grandparent;
+    }
+}
+
+void island_union(SDL_AtomicInt *parent, int a, int b){
+    for (;;){
+        a = island_find(parent, a);
+        b = island_find(parent, b);
+        if (a == b) return;
+        if (a < b){
+            int t = a;
+            a = b;
+            b = t;
+        }
+        // fails if a stopped being a root since the find; retry from there
+        if (SDL_CompareAndSwapAtomicInt(&parent[a], a, b)) return;
+    }
+}
+
+void island_reset_task(void *data, int begin, int end, int worker){
+    ContactIslands *is = data;
+    (void)worker;
+    for (int i = begin; i < end; i++){
+        SDL_SetAtomicInt(&is->parent[i], i);
+        is->island_of[i] = -1;
+    }
+}
+
+void island_union_task(void *data, int begin, int end, int worker){
+    ContactIslands *is = data;
+    (void)worker;
+    for (int k = begin; k < end; k++) island_union(is->parent, is->contacts->a[k], is->contacts->b[k]);
+}
+
+void island_root_task(void *data, int begin, int end, int worker){
+    ContactIslands *is = data;
+    (void)worker;
+    for (int i = begin; i < end; i++) is->root[i] = island_find(is->parent, i);
+}
+
+// Islands are numbered in order of their first contact and their contacts
+// keep the contact order, whatever order the unions ran in.
+void build_islands(ContactIslands *is, const ContactList *c){
+    islands_reserve(is, c->count);
+    is->contacts = c;
+    is->built_ball_count = ball_count;
+    parallel_for(island_reset_task, is, ball_count, SOLVE_CHUNK);
+    parallel_for(island_union_task, is, c->count, SOLVE_CHUNK);
+    parallel_for(island_root_task, is, ball_count, SOLVE_CHUNK);
+
+    is->island_count = 0;
+    for (int k = 0; k < c->count; k++){
+        int r = is->root[c->a[k]];
+        if (is->island_of[r] < 0){
+            is->island_of[r] = is->island_count;
+            is->start[is->island_count++] = 0;
+        }
+        is->start[is->island_of[r]]++;
+    }
+    int sum = 0;
+    for (int island = 0; island < is->island_count; island++){
+        sum += is->start[island];
+        is->start[island] = sum;
+    }
+    is->start[is->island_count] = sum;
+    for (int k = c->count - 1; k >= 0; k--) is->order[--is->start[is->island_of[is->root[c->a[k]]]]] = k;
+}
+
+void island_solve_task(void *data, int begin, int end, int worker){
+    const ContactIslands *is = data;
+    (void)worker;
+    (is->uniform ? solve_contacts_scalar_uniform : solve_contacts_scalar)(&balls, is->contacts, is->order, begin, end);
+}
 
+void solve_islands(ContactIslands *is, int uniform){
+    is->uniform = uniform;
+    is->task_count = 0;
+
+    TaskGroup group;
+    task_group_init(&group);
+    int begin = 0;
+    for (int island = 0; island < is->island_count; island++){
+        int end = is->start[island + 1];
+        if (end - begin < ISLAND_BATCH_CONTACTS && island + 1 < is->island_count) continue;
+        task_group_run(&group, 0, island_solve_task, is, begin, end);
+        is->task_count++;
+        begin = end;
+    }
+    task_group_wait(&group, 0);
+}
+
+void print_island_stats(ContactIslands *is){
+    int largest = 0, largest_balls = 0, island_balls = 0;
+    memset(is->ball_total, 0, is->island_count * sizeof(int));
+    for (int i = 0; i < is->built_ball_count; i++){
+        int island = is->island_of[is->root[i]];
+        if (island >= 0) is->ball_total[island]++;
+    }
+    for (int island = 0; island < is->island_count; island++){
+        int size = is->start[island + 1] - is->start[island];
+        if (size > is->start[largest + 1] - is->start[largest]) largest = island;
+        if (is->ball_total[island] > largest_balls) largest_balls = is->ball_total[island];
+        island_balls += is->ball_total[island];
+    }
+    printf("Islands: %d with %d balls in %d tasks", is->island_count, island_balls, is->task_count);
+    if (is->island_count > 0){
+        printf(", at most %d contacts and %d balls in one", is->start[largest + 1] - is->start[largest], largest_balls);
+    }
+    printf("\n");
+}
+
+// Fixed-point world step. The float arrays stay the source of edits (spawn,
+// push, delete); fixed_sync_from_float picks those up before each step, and
+// the fixed state is written back to them afterwards.
 typedef struct {
-    vec position;
-    vec velocity;
-    float radius;
-    float mass;
-} Ball;
+    int *a, *b;
+    fixed *nx, *ny;
+    fixed *depth;
+    int count;
+    int capacity;
+} FixedContactList;
 
-vec v_add(vec a, vec b){
-    return (vec){a.x + b.x, a.y + b.y};
+Grid fixed_grid;
+PairList fixed_pairs;
+FixedContactList fixed_contacts;
+
+// the float narrowphase's 0.1 px added to every distance
+#define FX_CONTACT_SLOP 6554
+
+void fixed_reserve(FixedArrays *f, int capacity){
+    if (capacity <= f->capacity) return;
+    f->capacity = capacity + capacity / 2;
+    f->x = realloc(f->x, f->capacity * sizeof(fixed));
+    f->y = realloc(f->y, f->capacity * sizeof(fixed));
+    f->vx = realloc(f->vx, f->capacity * sizeof(fixed));
+    f->vy = realloc(f->vy, f->capacity * sizeof(fixed));
+    f->radius = realloc(f->radius, f->capacity * sizeof(fixed));
+    f->inv_mass = realloc(f->inv_mass, f->capacity * sizeof(fixed));
 }
 
-vec v_sub(vec a, vec b){
-    return (vec){a.x - b.x, a.y - b.y};
+void fixed_contacts_reserve(FixedContactList *c, int capacity){
+    if (capacity <= c->capacity) return;
+    c->capacity = capacity + capacity / 2;
+    c->a = realloc(c->a, c->capacity * sizeof(int));
+    c->b = realloc(c->b, c->capacity * sizeof(int));
+    c->nx = realloc(c->nx, c->capacity * sizeof(fixed));
+    c->ny = realloc(c->ny, c->capacity * sizeof(fixed));
+    c->depth = realloc(c->depth, c->capacity * sizeof(fixed));
 }
 
-vec v_mul(vec a, float b){
-    return (vec){a.x * b, a.y * b};
+// After balls were added or removed an index may now hold a different ball
+// (backspace then click between two steps), so everything is converted again.
+// Otherwise a float value that no longer matches its fixed original was
+// changed from outside (a push) and is converted again.
+void fixed_sync_from_float(FixedArrays *f){
+    fixed_reserve(f, ball_count);
+    if (f->generation != ball_generation) f->count = 0;
+    f->generation = ball_generation;
+
+    for (int i = 0; i < f->count; i++){
+        if (balls.x[i] != fx_to_float(f->x[i])) f->x[i] = fx_from_float(balls.x[i]);
+        if (balls.y[i] != fx_to_float(f->y[i])) f->y[i] = fx_from_float(balls.y[i]);
+        if (balls.vx[i] != fx_to_float(f->vx[i])) f->vx[i] = fx_from_float(balls.vx[i]);
+        if (balls.vy[i] != fx_to_float(f->vy[i])) f->vy[i] = fx_from_float(balls.vy[i]);
+    }
+    for (int i = f->count; i < ball_count; i++){
+        f->x[i] = fx_from_float(balls.x[i]);
+        f->y[i] = fx_from_float(balls.y[i]);
+        f->vx[i] = fx_from_float(balls.vx[i]);
+        f->vy[i] = fx_from_float(balls.vy[i]);
+        f->radius[i] = fx_from_float(balls.radius[i]);
+        f->inv_mass[i] = fx_from_float(balls.inv_mass[i]);
+    }
+    f->count = ball_count;
 }
 
-float v_dot(vec a, vec b){
-    return (float)(a.x * b.x + a.y * b.y);
+void fixed_sync_to_float(const FixedArrays *f){
+    for (int i = 0; i < f->count; i++){
+        balls.x[i] = fx_to_float(f->x[i]);
+        balls.y[i] = fx_to_float(f->y[i]);
+        balls.vx[i] = fx_to_float(f->vx[i]);
+        balls.vy[i] = fx_to_float(f->vy[i]);
+    }
 }
 
-float v_len2(vec a){
-    return v_dot(a, a);
+int fixed_grid_coord(fixed v, fixed cell, int limit){
+    if (v < 0) return 0;
+    int c = v / cell;
+    return c < limit ? c : limit - 1;
 }
 
-Ball balls[MAX_BALLS];
-int ball_count = 0;
+// Same half stencil as grid_find_pairs, on integer cells and an integer
+// AABB test, so the pair list and its order depend only on the fixed state.
+void fixed_find_pairs(const FixedArrays *f, PairList *out){
+    fixed width = WINDOW_WIDTH * FX_ONE;
+    fixed height = WINDOW_HEIGHT * FX_ONE;
+    fixed cell = FX_ONE;
+    for (int i = 0; i < f->count; i++){
+        if (2 * f->radius[i] > cell) cell = 2 * f->radius[i];
+    }
+    while ((Sint64)(width / cell + 1) * (height / cell + 1) > GRID_MAX_CELLS) cell *= 2;
 
-void spawn_ball(float x, float y){
-    balls[ball_count].position.x = x;
-    balls[ball_count].position.y = y;
+    Grid *g = &fixed_grid;
+    g->cell_size = fx_to_float(cell);
+    g->inv_cell_size = 1.0f / g->cell_size;
+    g->cols = width / cell + 1;
+    g->rows = height / cell + 1;
+    grid_reserve(g, f->count);
+    for (int i = 0; i < f->count; i++){
+        g->ball_cell[i] = fixed_grid_coord(f->y[i], cell, g->rows) * g->cols + fixed_grid_coord(f->x[i], cell, g->cols);
+    }
+    grid_sort(g, NULL, f->count, NULL);
 
-    balls[ball_count].velocity.x =  ((rand() % 3) * 2 - 1) * 10;
-    balls[ball_count].velocity.y =  ((rand() % 3) * 2 - 1) * 10;
+    static const int offsets[5][2] = {{0, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+    out->count = 0;
+    for (int cy = 0; cy < g->rows; cy++){
+        for (int cx = 0; cx < g->cols; cx++){
+            int c = cy * g->cols + cx;
+            int begin = g->cell_start[c];
+            int end = g->cell_start[c + 1];
+            if (begin == end) continue;
 
-    balls[ball_count].radius = 25.0f;
-    balls[ball_count].mass = fabs((rand() % 3) * 2 - 1);
-    ball_count++;
+            for (int n = 0; n < 5; n++){
+                int nx = cx + offsets[n][0];
+                int ny = cy + offsets[n][1];
+                if (nx < 0 || nx >= g->cols || ny >= g->rows) continue;
+
+                int nc = ny * g->cols + nx;
+                for (int k = begin; k < end; k++){
+                    int i = g->cell_balls[k];
+                    for (int m = n == 0 ? k + 1 : g->cell_start[nc]; m < g->cell_start[nc + 1]; m++){
+                        int j = g->cell_balls[m];
+                        fixed reach = f->radius[i] + f->radius[j];
+                        broadphase_pair_tests++;
+                        if (abs(f->x[j] - f->x[i]) < reach && abs(f->y[j] - f->y[i]) < reach) pairs_push(out, i, j);
+                    }
+                }
+            }
+        }
+    }
 }
 
-void handle_box_collisions(Ball *ball);
-void handle_ball_to_ball_collision(Ball *ball1, Ball *ball2);
+// Integer square root, rounded down. The root of a Q32.32 value is Q16.16.
+Uint32 isqrt64(Uint64 v){
+    Uint64 root = 0;
+    Uint64 bit = (Uint64)1 << 62;
+    while (bit > v) bit >>= 2;
+    while (bit){
+        if (v >= root + bit){
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else root >>= 1;
+        bit >>= 2;
+    }
+    return (Uint32)root;
+}
 
-void update_balls(float dt) {
-    float gravity = 0.0f;
+void fixed_narrowphase(const FixedArrays *f, const PairList *p, FixedContactList *out){
+    for (int k = 0; k < p->count; k++){
+        int i = p->a[k];
+        int j = p->b[k];
+        fixed dx = f->x[j] - f->x[i];
+        fixed dy = f->y[j] - f->y[i];
+        fixed reach = f->radius[i] + f->radius[j];
+        Sint64 d2 = (Sint64)dx * dx + (Sint64)dy * dy;
+        if (d2 >= (Sint64)reach * reach) continue;
 
-    for (int i = 0; i < ball_count; i++) {
-        balls[i].velocity.y += gravity * dt;
-        balls[i].position.x += balls[i].velocity.x * dt;
-        balls[i].position.y += balls[i].velocity.y * dt;
+        fixed dist = (fixed)isqrt64((Uint64)d2) + FX_CONTACT_SLOP;
+        if (dist >= reach) continue;
+        if (dx == 0 && dy == 0) dx = dist;
 
-        handle_box_collisions(&balls[i]);
+        int c = out->count++;
+        out->a[c] = i;
+        out->b[c] = j;
+        out->nx[c] = (fixed)((Sint64)dx * FX_ONE / dist);
+        out->ny[c] = (fixed)((Sint64)dy * FX_ONE / dist);
+        out->depth[c] = reach - dist;
+    }
+}
 
-        for (int j = i + 1; j < ball_count; j++){
-            float dx = balls[j].position.x - balls[i].position.x;
-            float dy = balls[j].position.y - balls[i].position.y;
-            float dist = sqrt(dx * dx + dy * dy) + 0.1f;
+// Sequential integer version of solve_contacts_scalar. Dot products and
+// squared lengths are Q32.32 in 64 bits; centres closer than a pixel after
+// the push have no reliable line of centres and get no impulse.
+void fixed_solve(const FixedArrays *f, const FixedContactList *c, int uniform){
+    for (int k = 0; k < c->count; k++){
+        int i = c->a[k];
+        int j = c->b[k];
+        fixed push_x = fx_mul(c->nx[k], c->depth[k]) >> 1;
+        fixed push_y = fx_mul(c->ny[k], c->depth[k]) >> 1;
+        f->x[i] -= push_x;
+        f->y[i] -= push_y;
+        f->x[j] += push_x;
+        f->y[j] += push_y;
+
+        fixed dx = f->x[i] - f->x[j];
+        fixed dy = f->y[i] - f->y[j];
+        Sint64 len2 = ((Sint64)dx * dx + (Sint64)dy * dy) >> FX_SHIFT;
+        if (len2 < FX_ONE) continue;
+        Sint64 dot = (Sint64)(f->vx[i] - f->vx[j]) * dx + (Sint64)(f->vy[i] - f->vy[j]) * dy;
+        fixed s = (fixed)(dot / len2);
+
+        fixed si = s, sj = s;
+        if (!uniform){
+            fixed inv_sum = f->inv_mass[i] + f->inv_mass[j];
+            si = fx_mul((fixed)(2 * (Sint64)f->inv_mass[j] * FX_ONE / inv_sum), s);
+            sj = fx_mul((fixed)(2 * (Sint64)f->inv_mass[i] * FX_ONE / inv_sum), s);
+        }
+        f->vx[i] -= fx_mul(dx, si);
+        f->vy[i] -= fx_mul(dy, si);
+        f->vx[j] += fx_mul(dx, sj);
+        f->vy[j] += fx_mul(dy, sj);
+    }
+}
+
+// Integration and walls run on the pool, but each ball's result depends
+// only on that ball, and the grid's parallel sort gives the same order as the
+// serial one; pairs, narrowphase and solve are serial. The step is therefore
+// bit-identical for any worker count as well as any kernel set.
+typedef struct {
+    fixed dt;
+    fixed gravity;
+} FixedMotionPhase;
+
+void fixed_motion_task(void *data, int begin, int end, int worker){
+    const FixedMotionPhase *m = data;
+    (void)worker;
+    kernels.integrate_fixed(&fixed_balls, begin, end, m->dt, m->gravity);
+    kernels.walls_fixed(&fixed_balls, begin, end, WINDOW_WIDTH * FX_ONE, WINDOW_HEIGHT * FX_ONE);
+}
+
+void update_balls_fixed(float dt){
+    FixedArrays *f = &fixed_balls;
+    FixedMotionPhase motion = {fx_from_float(dt), 0};
+
+    fixed_sync_from_float(f);
+    parallel_for(fixed_motion_task, &motion, f->count, MOTION_CHUNK);
+
+    fixed_find_pairs(f, &fixed_pairs);
+    fixed_contacts.count = 0;
+    fixed_contacts_reserve(&fixed_contacts, fixed_pairs.count);
+    fixed_narrowphase(f, &fixed_pairs, &fixed_contacts);
+    fixed_solve(f, &fixed_contacts, uniform_mass);
+    fixed_sync_to_float(f);
+}
+
+// Large world step. Balls spawned since the last step are in view
+// coordinates and are moved into the world at the camera; pairs come from a
+// hashed grid whose cells are keyed by global cell coordinates.
+Sint32 camera_tile_x = WORLD_TILES / 2;
+Sint32 camera_tile_y = WORLD_TILES / 2;
+float camera_x = 0.0f;
+float camera_y = 0.0f;
+
+PairSet world_cells;
+Grid world_grid;
+
+// Moves a whole number of tiles from the offset into the tile index.
+void tile_wrap(Sint32 *tile, float *offset){
+    float shift = floorf(*offset / WORLD_TILE_SIZE);
+    *tile += (Sint32)shift;
+    *offset -= shift * WORLD_TILE_SIZE;
+    // a tiny negative offset rounds up to the full tile size
+    if (*offset >= WORLD_TILE_SIZE){
+        *tile += 1;
+        *offset = 0.0f;
+    }
+}
+
+void tiles_sync(BallTiles *t){
+    if (ball_count > t->capacity){
+        t->capacity = ball_count + ball_count / 2;
+        t->x = realloc(t->x, t->capacity * sizeof(Sint32));
+        t->y = realloc(t->y, t->capacity * sizeof(Sint32));
+    }
+    if (t->count > ball_count) t->count = ball_count;
+
+    for (int i = t->count; i < ball_count; i++){
+        t->x[i] = camera_tile_x;
+        t->y[i] = camera_tile_y;
+        balls.x[i] += camera_x;
+        balls.y[i] += camera_y;
+        tile_wrap(&t->x[i], &balls.x[i]);
+        tile_wrap(&t->y[i], &balls.y[i]);
+    }
+    t->count = ball_count;
+}
+
+void wrap_ball_tiles(BallTiles *t, int begin, int end){
+    for (int i = begin; i < end; i++){
+        if (balls.x[i] < 0.0f || balls.x[i] >= WORLD_TILE_SIZE) tile_wrap(&t->x[i], &balls.x[i]);
+        if (balls.y[i] < 0.0f || balls.y[i] >= WORLD_TILE_SIZE) tile_wrap(&t->y[i], &balls.y[i]);
+    }
+}
+
+// The world's outer walls; only balls in the edge tiles (or pushed past them)
+// can touch one. Same response as walls_scalar.
+void walls_large(const BallArrays *b, const BallTiles *t, int begin, int end){
+    Sint32 last = WORLD_TILES - 1;
+    for (int i = begin; i < end; i++){
+        float r = b->radius[i];
+        if (t->y[i] > last || (t->y[i] == last && b->y[i] + r > WORLD_TILE_SIZE)){
+            t->y[i] = last;
+            b->y[i] = WORLD_TILE_SIZE - r;
+            b->vy[i] *= -1/2.0f;
+        }
+        if (t->y[i] < 0 || (t->y[i] == 0 && b->y[i] - r < 0)){
+            t->y[i] = 0;
+            b->y[i] = r;
+            if (b->vy[i] < 1) b->vy[i] = 0;
+            b->vy[i] *= -1/2.0f;
+        }
+
+        if (t->x[i] < 0 || (t->x[i] == 0 && b->x[i] - r < 0)){
+            t->x[i] = 0;
+            b->x[i] = r;
+            b->vx[i] *= -1/2.0f;
+        }
+        if (t->x[i] > last || (t->x[i] == last && b->x[i] + r > WORLD_TILE_SIZE)){
+            t->x[i] = last;
+            b->x[i] = WORLD_TILE_SIZE - r;
+            b->vx[i] *= -1/2.0f;
+        }
+    }
+}
+
+Uint64 world_cell_key(Sint32 gx, Sint32 gy){
+    return ((Uint64)(Uint32)gy << 32) | (Uint32)gx;
+}
 
-            float percent = 0.5f;
+// Not clamped to the tile: an offset the solver pushed slightly outside its
+// tile lands in the neighbouring tile's cell, where it belongs.
+int world_cell_coord(Sint32 tile, float offset, int cells_per_tile){
+    return tile * cells_per_tile + (int)floorf(offset * (float)cells_per_tile / WORLD_TILE_SIZE);
+}
+
+int world_overlap(int i, int j){
+    broadphase_pair_tests++;
+    float reach = balls.radius[i] + balls.radius[j];
+    return fabsf(world_dx(i, j)) < reach && fabsf(world_dy(i, j)) < reach;
+}
+
+// Occupied cells get dense indices from the PairSet, the balls are counting
+// sorted by that index, and each cell is paired with itself and its E, SW, S
+// and SE neighbours as in grid_find_pairs.
+void large_world_find_pairs(const BallTiles *t, PairList *out){
+    static const int offsets[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+    // no balls, no radius to size the cells by
+    if (t->count == 0){
+        pair_set_clear(&world_cells);
+        out->count = 0;
+        return;
+    }
+    int cells_per_tile = (int)(WORLD_TILE_SIZE / (2.0f * max_ball_radius()));
+    if (cells_per_tile < 1) cells_per_tile = 1;
+    if (cells_per_tile > 256) cells_per_tile = 256;
 
-            if (dist < balls[i].radius + balls[j].radius){
-                float overlap = balls[i].radius + balls[j].radius - dist;
+    Grid *g = &world_grid;
+    grid_reserve(g, t->count);
+    pair_set_clear(&world_cells);
+    for (int i = 0; i < t->count; i++){
+        Uint64 key = world_cell_key(world_cell_coord(t->x[i], balls.x[i], cells_per_tile), world_cell_coord(t->y[i], balls.y[i], cells_per_tile));
+        pair_set_insert(&world_cells, key);
+        g->ball_cell[i] = world_cells.table_slots[pair_set_find(&world_cells, key)];
+    }
+    g->cols = world_cells.count;
+    g->rows = 1;
+    grid_reserve(g, t->count);
+    grid_sort(g, NULL, t->count, NULL);
 
-                float nx = dx / dist;
-                float ny = dy / dist;
+    out->count = 0;
+    for (int c = 0; c < world_cells.count; c++){
+        int begin = g->cell_start[c];
+        int end = g->cell_start[c + 1];
+        for (int k = begin; k < end; k++){
+            for (int m = k + 1; m < end; m++){
+                if (world_overlap(g->cell_balls[k], g->cell_balls[m])) pairs_push(out, g->cell_balls[k], g->cell_balls[m]);
+            }
+        }
 
-                balls[i].position.x -= nx * overlap * percent;
-                balls[i].position.y -= ny * overlap * percent;
-                balls[j].position.x += nx * overlap * percent;
-                balls[j].position.y += ny * overlap * percent;
+        Sint32 gx = (Sint32)(Uint32)world_cells.keys[c];
+        Sint32 gy = (Sint32)(world_cells.keys[c] >> 32);
+        for (int n = 0; n < 4; n++){
+            int slot = pair_set_find(&world_cells, world_cell_key(gx + offsets[n][0], gy + offsets[n][1]));
+            if (slot < 0) continue;
 
-                handle_ball_to_ball_collision(&balls[i], &balls[j]);
+            int nc = world_cells.table_slots[slot];
+            for (int k = begin; k < end; k++){
+                for (int m = g->cell_start[nc]; m < g->cell_start[nc + 1]; m++){
+                    if (world_overlap(g->cell_balls[k], g->cell_balls[m])) pairs_push(out, g->cell_balls[k], g->cell_balls[m]);
+                }
             }
         }
     }
 }
 
-void handle_box_collisions(Ball *ball) {
-    if (ball->position.y + ball->radius > WINDOW_HEIGHT) {
-        ball->position.y = WINDOW_HEIGHT - ball->radius;
+void narrowphase_large(const int *pair_a, const int *pair_b, int count, ContactList *out){
+    for (int p = 0; p < count; p++){
+        int i = pair_a[p];
+        int j = pair_b[p];
+        float dx = world_dx(i, j);
+        float dy = world_dy(i, j);
+        float reach = balls.radius[i] + balls.radius[j];
+        if (dx * dx + dy * dy < reach * reach) narrowphase_emit(i, j, dx, dy, reach, out);
+    }
+}
+
+void large_motion_task(void *data, int begin, int end, int worker){
+    const MotionPhase *m = data;
+    (void)worker;
+    kernels.integrate(&balls, begin, end, m->dt, m->gravity);
+    wrap_ball_tiles(&tiles, begin, end);
+    walls_large(&balls, &tiles, begin, end);
+}
+
+void update_balls_large(float dt){
+    MotionPhase motion = {dt, 0.0f, NULL};
+
+    tiles_sync(&tiles);
+    parallel_for(large_motion_task, &motion, ball_count, MOTION_CHUNK);
+
+    large_world_find_pairs(&tiles, &pairs);
+
+    contacts.count = 0;
+    contacts_reserve(&contacts, pairs.count);
+    narrowphase_large(pairs.a, pairs.b, pairs.count, &contacts);
+    solve_contacts_large(&balls, &contacts, 0, contacts.count);
+}
+
+// Entering converts every ball from view coordinates on the next step;
+// leaving puts every ball back in view coordinates, so balls far from the
+// view end up against the window walls.
+void set_large_world(int on){
+    if (on == large_world) return;
+    if (on){
+        fixed_mode = 0;
+        tiles.count = 0;
+    } else {
+        tiles_sync(&tiles);
+        for (int i = 0; i < ball_count; i++){
+            balls.x[i] += (float)(tiles.x[i] - camera_tile_x) * WORLD_TILE_SIZE - camera_x;
+            balls.y[i] += (float)(tiles.y[i] - camera_tile_y) * WORLD_TILE_SIZE - camera_y;
+        }
+    }
+    large_world = on;
+}
+
+void pan_camera(float dx, float dy){
+    camera_x += dx;
+    camera_y += dy;
+    tile_wrap(&camera_tile_x, &camera_x);
+    tile_wrap(&camera_tile_y, &camera_y);
+}
+
+// Drops the last count balls. Their tiles go too, so balls spawned into the
+// freed indices before the next step are placed at the camera by tiles_sync
+// instead of inheriting the removed balls' tiles.
+void remove_balls(int count){
+    ball_count -= count;
+    ball_generation++;
+    if (tiles.count > ball_count) tiles.count = ball_count;
+    refresh_uniformity();
+}
+
+// Right-click push around the view point (x, y). In the large world the
+// balls hold tile offsets, so the point is moved into the camera's tile and
+// distances are taken in world units; balls spawned since the last step are
+// still in view coordinates.
+void push_away_from(float x, float y, float radius){
+    vec center = {x, y};
+    if (!large_world){
+        query_balls_in_circle(x, y, radius, push_away_visit, &center);
+        return;
+    }
+
+    Sint32 tile_x = camera_tile_x, tile_y = camera_tile_y;
+    float offset_x = camera_x + x, offset_y = camera_y + y;
+    tile_wrap(&tile_x, &offset_x);
+    tile_wrap(&tile_y, &offset_y);
+    for (int i = 0; i < ball_count; i++){
+        vec d = i < tiles.count ? (vec){world_point_dx(tile_x, offset_x, i), world_point_dy(tile_y, offset_y, i)} : v_sub(ball_position(i), center);
+        float reach = radius + balls.radius[i];
+        if (v_len2(d) < reach * reach) push_ball_away(i, d);
+    }
+}
+
+void update_balls(float dt) {
+    float gravity = 0.0f;
+
+    if (fixed_mode){
+        update_balls_fixed(dt);
+        return;
+    }
+    if (large_world){
+        update_balls_large(dt);
+        return;
+    }
+
+    if (reorder_interval > 0 && ball_count > 0 && ++reorder_step >= reorder_interval){
+        Uint64 start = SDL_GetPerformanceCounter();
+        reorder_balls(&reorder);
+        reorder_ticks = SDL_GetPerformanceCounter() - start;
+        reorder_step = 0;
+    }
+
+    MotionPhase motion = {dt, gravity, uniform_radius ? kernels.walls_uniform : kernels.walls};
+    parallel_for(motion_task, &motion, ball_count, MOTION_CHUNK);
+
+    find_pairs(&pairs);
+
+    contacts.count = 0;
+    contacts_reserve(&contacts, pairs.count);
+    (uniform_radius ? kernels.narrowphase_uniform : kernels.narrowphase)(&balls, pairs.a, pairs.b, pairs.count, &contacts);
+
+    if (solver_mode == SOLVER_COLOURED){
+        colour_contacts(&contact_colouring, &contacts);
+        solve_coloured(&contact_colouring, uniform_mass);
+        return;
+    }
+    if (solver_mode == SOLVER_JACOBI){
+        solve_jacobi(&jacobi, &contacts, uniform_mass);
+        return;
+    }
+    if (solver_mode == SOLVER_ISLANDS){
+        build_islands(&islands, &contacts);
+        solve_islands(&islands, uniform_mass);
+        return;
+    }
+
+    void (*solve_rest)(const BallArrays *, const ContactList *, const int *, int, int) = uniform_mass ? solve_contacts_scalar_uniform : solve_contacts_scalar;
+    int batched = solver_mode == SOLVER_BATCHED ? batch_contacts(&contact_batcher, &contacts, kernels.solve_width) : 0;
+    if (batched > 0){
+        (uniform_mass ? kernels.solve_uniform : kernels.solve)(&balls, &contacts, contact_batcher.order, 0, batched);
+        solve_rest(&balls, &contacts, contact_batcher.order, batched, contacts.count);
+    }
+    else solve_rest(&balls, &contacts, NULL, 0, contacts.count);
+}
+
+// Kernel benchmark (--bench): times every kernel set this CPU supports on the
+// same scene and prints each kernel's gain over AVX2. No window is opened.
+#define BENCH_BALLS 20000
+#define BENCH_STEPS 200
+
+typedef struct {
+    double integrate, walls, narrowphase, narrowphase_uniform;
+} KernelTimes;
+
+double bench_ms(Uint64 ticks){
+    return (double)ticks * 1000.0 / (double)SDL_GetPerformanceFrequency() / BENCH_STEPS;
+}
+
+KernelTimes bench_kernels(const Kernels *k, float *const saved[4]){
+    float *arrays[4] = {balls.x, balls.y, balls.vx, balls.vy};
+    KernelTimes t;
 
-        ball->velocity.y *= -1/2.0f;
+    for (int a = 0; a < 4; a++) memcpy(arrays[a], saved[a], ball_count * sizeof(float));
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int step = 0; step < BENCH_STEPS; step++) k->integrate(&balls, 0, ball_count, 1/60.0f, 0.0f);
+    t.integrate = bench_ms(SDL_GetPerformanceCounter() - start);
+
+    for (int a = 0; a < 4; a++) memcpy(arrays[a], saved[a], ball_count * sizeof(float));
+    start = SDL_GetPerformanceCounter();
+    for (int step = 0; step < BENCH_STEPS; step++) k->walls(&balls, 0, ball_count, WINDOW_WIDTH, WINDOW_HEIGHT);
+    t.walls = bench_ms(SDL_GetPerformanceCounter() - start);
+
+    for (int a = 0; a < 4; a++) memcpy(arrays[a], saved[a], ball_count * sizeof(float));
+    start = SDL_GetPerformanceCounter();
+    for (int step = 0; step < BENCH_STEPS; step++){
+        contacts.count = 0;
+        k->narrowphase(&balls, pairs.a, pairs.b, pairs.count, &contacts);
+    }
+    t.narrowphase = bench_ms(SDL_GetPerformanceCounter() - start);
+
+    // the scene has a single radius
+    start = SDL_GetPerformanceCounter();
+    for (int step = 0; step < BENCH_STEPS; step++){
+        contacts.count = 0;
+        k->narrowphase_uniform(&balls, pairs.a, pairs.b, pairs.count, &contacts);
     }
-    if (ball->position.y - ball->radius < 0) {
-        ball->position.y = ball->radius;
-        if (ball->velocity.y < 1) ball->velocity.y = 0;
-        ball->velocity.y *= -1/2.0f;
+    t.narrowphase_uniform = bench_ms(SDL_GetPerformanceCounter() - start);
+    return t;
+}
+
+int run_kernel_benchmark(void){
+    const Kernels *sets[5];
+    int set_count = 0;
+    sets[set_count++] = &kernels_scalar;
+#ifdef SDL_NEON_INTRINSICS
+    if (SDL_HasNEON()) sets[set_count++] = &kernels_neon;
+#endif
+#ifdef SDL_SSE2_INTRINSICS
+    if (SDL_HasSSE2()) sets[set_count++] = &kernels_sse2;
+#endif
+    int baseline = -1;
+#ifdef SDL_AVX2_INTRINSICS
+    if (SDL_HasAVX2()){
+        baseline = set_count;
+        sets[set_count++] = &kernels_avx2;
     }
+#endif
+#ifdef SDL_AVX512F_INTRINSICS
+    if (SDL_HasAVX512F()) sets[set_count++] = &kernels_avx512;
+#endif
 
-    if (ball->position.x - ball->radius < 0) {
-        ball->position.x = ball->radius;
-        ball->velocity.x *= -1/2.0f;
+    srand(1);
+    spawn_radius_min = spawn_radius_max = 4;
+    for (int i = 0; i < BENCH_BALLS; i++) spawn_ball((float)(rand() % WINDOW_WIDTH), (float)(rand() % WINDOW_HEIGHT));
+    if (ball_count < BENCH_BALLS) return -1;
+    find_pairs(&pairs);
+    contacts_reserve(&contacts, pairs.count);
+
+    float *saved[4];
+    float *arrays[4] = {balls.x, balls.y, balls.vx, balls.vy};
+    for (int a = 0; a < 4; a++){
+        saved[a] = malloc(ball_count * sizeof(float));
+        memcpy(saved[a], arrays[a], ball_count * sizeof(float));
     }
-    if (ball->position.x + ball->radius > WINDOW_WIDTH) {
-        ball->position.x = WINDOW_WIDTH - ball->radius;
-        ball->velocity.x *= -1/2.0f;
+
+    KernelTimes times[5];
+    for (int s = 0; s < set_count; s++) times[s] = bench_kernels(sets[s], saved);
+
+    printf("%d balls, %d candidate pairs, %d contacts, ms per step:\n", ball_count, pairs.count, contacts.count);
+    printf("%-8s %10s %10s %12s %12s\n", "kernels", "integrate", "walls", "narrowphase", "uniform r");
+    for (int s = 0; s < set_count; s++){
+        printf("%-8s %10.4f %10.4f %12.4f %12.4f", sets[s]->name, times[s].integrate, times[s].walls, times[s].narrowphase, times[s].narrowphase_uniform);
+        if (baseline >= 0 && s > baseline){
+            printf("   x%.2f x%.2f x%.2f x%.2f vs AVX2", times[baseline].integrate / times[s].integrate,
+                   times[baseline].walls / times[s].walls, times[baseline].narrowphase / times[s].narrowphase,
+                   times[baseline].narrowphase_uniform / times[s].narrowphase_uniform);
+        }
+        printf("\n");
     }
+
+    for (int a = 0; a < 4; a++) free(saved[a]);
+    return 0;
 }
 
-void handle_ball_to_ball_collision(Ball *ball1, Ball *ball2){
-    vec rel_pos_ball1 = v_sub(ball1->position, ball2->position);
-    vec rel_pos_ball2 = v_sub(ball2->position, ball1->position);
+// Scaling benchmark (--bench-threads): times the parallel integrate + walls
+// phase and the grid build on SCALING_BALLS balls with 1, 2, 4, ... workers
+// up to the core count.
+#define SCALING_BALLS (1 << 20)
+#define SCALING_STEPS 100
 
-    float b1_len2 = v_len2(rel_pos_ball1);
-    float b2_len2 = v_len2(rel_pos_ball2);
+int run_scaling_benchmark(void){
+    select_kernels();
+    srand(1);
+    spawn_radius_min = spawn_radius_max = 4;
+    if (!reserve_balls(SCALING_BALLS)) return -1;
+    for (int i = 0; i < SCALING_BALLS; i++) spawn_ball((float)(rand() % WINDOW_WIDTH), (float)(rand() % WINDOW_HEIGHT));
 
-    vec rel_vel_ball1 = v_sub(ball1->velocity, ball2->velocity);
-    vec rel_vel_ball2 = v_sub(ball2->velocity, ball1->velocity);
+    int cores = SDL_GetNumLogicalCPUCores();
+    MotionPhase motion = {1/60.0f, 0.0f, kernels.walls};
+    float cell_size = 2.0f * max_ball_radius();
+    double single_motion = 0.0, single_grid = 0.0;
+    double to_ms = 1000.0 / (double)SDL_GetPerformanceFrequency() / SCALING_STEPS;
+    printf("%d balls, %s kernels, %d logical cores, ms per step:\n", ball_count, kernels.name, cores);
+    printf("%-8s %12s %9s %11s %9s\n", "workers", "integrate+w", "speedup", "grid build", "speedup");
+    for (int workers = 1; ; workers = workers * 2 < cores ? workers * 2 : cores){
+        pool_start(workers);
+        parallel_for(motion_task, &motion, ball_count, MOTION_CHUNK);
+        grid_build(&grid, cell_size, WINDOW_WIDTH, WINDOW_HEIGHT, NULL, ball_count);
 
-    float dot_prod_ball1 = v_dot(rel_vel_ball1, rel_pos_ball1);
-    float dot_prod_ball2 = v_dot(rel_vel_ball2, rel_pos_ball2);
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int step = 0; step < SCALING_STEPS; step++) parallel_for(motion_task, &motion, ball_count, MOTION_CHUNK);
+        double motion_ms = (double)(SDL_GetPerformanceCounter() - start) * to_ms;
 
-    float mass_factor_ball1 = 2.0f * ball1->mass / (ball1->mass + ball2->mass);
-    float mass_factor_ball2 = 2.0f * ball2->mass / (ball1->mass + ball2->mass);
+        start = SDL_GetPerformanceCounter();
+        for (int step = 0; step < SCALING_STEPS; step++) grid_build(&grid, cell_size, WINDOW_WIDTH, WINDOW_HEIGHT, NULL, ball_count);
+        double grid_ms = (double)(SDL_GetPerformanceCounter() - start) * to_ms;
 
-    ball1->velocity = v_sub(ball1->velocity, v_mul(rel_pos_ball1, mass_factor_ball1 * dot_prod_ball1 / b1_len2));
-    ball2->velocity = v_sub(ball2->velocity, v_mul(rel_pos_ball2, mass_factor_ball2 * dot_prod_ball2 / b2_len2));
+        if (workers == 1){
+            single_motion = motion_ms;
+            single_grid = grid_ms;
+        }
+        printf("%-8d %12.4f %8.2fx %11.4f %8.2fx\n", pool.worker_count, motion_ms, single_motion / motion_ms, grid_ms, single_grid / grid_ms);
+        if (workers >= cores) break;
+    }
+    pool_stop();
+    return 0;
 }
 
 void draw_ball(SDL_Renderer *renderer, float px, float py, int radius){
@@ -164,16 +4383,239 @@ void draw_ball(SDL_Renderer *renderer, float px, float py, int radius){
     SDL_RenderGeometry(renderer, NULL, vertices, vertex_count, indices, indices_count);
 }
 
-void render_balls(SDL_Renderer *renderer){
-    for (int i = 0; i < ball_count; i++){
-        draw_ball(renderer, balls[i].position.x, balls[i].position.y, balls[i].radius);
+// The simulation runs on its own thread and owns every ball and setting.
+// The render thread forwards input as SDL events through a single-producer,
+// single-consumer ring, and draws from position snapshots the simulation
+// publishes through a triple buffer: each side owns one snapshot and the
+// third sits between them, swapped in with one atomic exchange, so neither
+// side ever waits for the other. The render thread draws the newest complete
+// snapshot, or the last one again if no new one is ready.
+#define EVENT_QUEUE_SIZE 256
+#define SNAPSHOT_FRESH 4            // set on the shared index when it holds an unread snapshot
+#define SIMULATION_MIN_STEP (1.0 / 240.0)
+
+typedef struct {
+    SDL_Event events[EVENT_QUEUE_SIZE];
+    SDL_AtomicInt head;             // next to read, moved by the simulation
+    SDL_AtomicInt tail;             // next to write, moved by the render thread
+} EventQueue;
+
+// Screen positions and radii of the balls to draw; in the large world only
+// the balls in view, relative to the camera.
+typedef struct {
+    float *x, *y, *radius;
+    int count;
+    int capacity;
+} Snapshot;
+
+typedef struct {
+    SDL_Thread *thread;
+    SDL_AtomicInt quit;
+    EventQueue events;
+    Snapshot snapshots[3];
+    SDL_AtomicInt shared;           // snapshot between the two sides, | SNAPSHOT_FRESH
+    int back;                       // written by the simulation
+    int front;                      // drawn by the render thread
+} Simulation;
+
+Simulation simulation = {.back = 0, .front = 2};
+
+float simulation_speed = 1.0f;
+
+// Returns 0 when the queue is full; the event is dropped.
+int event_queue_push(EventQueue *q, const SDL_Event *event){
+    int tail = SDL_GetAtomicInt(&q->tail);
+    int next = (tail + 1) % EVENT_QUEUE_SIZE;
+    if (next == SDL_GetAtomicInt(&q->head)) return 0;
+    q->events[tail] = *event;
+    SDL_SetAtomicInt(&q->tail, next);
+    return 1;
+}
+
+int event_queue_pop(EventQueue *q, SDL_Event *event){
+    int head = SDL_GetAtomicInt(&q->head);
+    if (head == SDL_GetAtomicInt(&q->tail)) return 0;
+    *event = q->events[head];
+    SDL_SetAtomicInt(&q->head, (head + 1) % EVENT_QUEUE_SIZE);
+    return 1;
+}
+
+void snapshot_reserve(Snapshot *snap, int capacity){
+    if (capacity <= snap->capacity) return;
+    snap->capacity = capacity;
+    snap->x = realloc(snap->x, capacity * sizeof(float));
+    snap->y = realloc(snap->y, capacity * sizeof(float));
+    snap->radius = realloc(snap->radius, capacity * sizeof(float));
+}
+
+void publish_snapshot(Simulation *sim){
+    Snapshot *snap = &sim->snapshots[sim->back];
+    snapshot_reserve(snap, ball_capacity);
+    if (large_world){
+        snap->count = 0;
+        for (int i = 0; i < tiles.count; i++){
+            float x = balls.x[i] + (float)(tiles.x[i] - camera_tile_x) * WORLD_TILE_SIZE - camera_x;
+            float y = balls.y[i] + (float)(tiles.y[i] - camera_tile_y) * WORLD_TILE_SIZE - camera_y;
+            float r = balls.radius[i];
+            if (x + r < 0 || y + r < 0 || x - r > WINDOW_WIDTH || y - r > WINDOW_HEIGHT) continue;
+            snap->x[snap->count] = x;
+            snap->y[snap->count] = y;
+            snap->radius[snap->count++] = r;
+        }
+    } else {
+        memcpy(snap->x, balls.x, ball_count * sizeof(float));
+        memcpy(snap->y, balls.y, ball_count * sizeof(float));
+        memcpy(snap->radius, balls.radius, ball_count * sizeof(float));
+        snap->count = ball_count;
+    }
+    sim->back = SDL_SetAtomicInt(&sim->shared, sim->back | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
+}
+
+const Snapshot *latest_snapshot(Simulation *sim){
+    if (SDL_GetAtomicInt(&sim->shared) & SNAPSHOT_FRESH){
+        sim->front = SDL_SetAtomicInt(&sim->shared, sim->front) & ~SNAPSHOT_FRESH;
+    }
+    return &sim->snapshots[sim->front];
+}
+
+void render_snapshot(SDL_Renderer *renderer, const Snapshot *snap){
+    for (int i = 0; i < snap->count; i++){
+        draw_ball(renderer, snap->x[i], snap->y[i], snap->radius[i]);
+    }
+}
+
+// Input, applied on the simulation thread between steps.
+void handle_event(const SDL_Event *event){
+    if (event->type == SDL_EVENT_MOUSE_BUTTON_DOWN && event->button.button == SDL_BUTTON_RIGHT){
+        push_away_from(event->button.x, event->button.y, 100.0f);
+    }
+    else if (event->type == SDL_EVENT_MOUSE_BUTTON_DOWN){
+        for (int i = 0; i < 10; i++){
+            spawn_ball(event->button.x, event->button.y);
+        }
+        printf("%d ", ball_count);
+    }
+    else if (event->type == SDL_EVENT_WINDOW_RESIZED){
+        WINDOW_WIDTH = event->window.data1;
+        WINDOW_HEIGHT = event->window.data2;
+    }
+    else if (event->type == SDL_EVENT_KEY_DOWN){
+        if (event->key.key == SDLK_UP){
+            simulation_speed += 0.5f;
+            printf("Simulation speed: %.2f\n", simulation_speed);
+        }
+        else if (event->key.key == SDLK_DOWN){
+            if (simulation_speed > 0.0f){
+                simulation_speed -= 0.5f;
+                printf("Simulation speed: %.2f\n", simulation_speed);
+            }
+        }
+        else if (event->key.key == SDLK_B){
+            broadphase_mode = (broadphase_mode + 1) % (BROADPHASE_COUNT + 1);
+            broadphase_auto.trial = broadphase_auto.chosen = -1;
+            printf("Broadphase: %s\n", broadphase_mode_name(broadphase_mode));
+        }
+        else if (event->key.key == SDLK_I){
+            print_broadphase_stats();
+            if (reorder_interval > 0) printf("Last reorder: %.3f ms\n", (double)reorder_ticks * 1000.0 / (double)SDL_GetPerformanceFrequency());
+            if (solver_mode == SOLVER_BATCHED) printf("Contacts: %d, %d solved in %s batches\n", contacts.count, contact_batcher.batched, kernels.name);
+            if (solver_mode == SOLVER_COLOURED){
+                printf("Contacts: %d in %d colours, %d in the first, %d uncoloured\n", contacts.count, contact_colouring.colour_count,
+                       contact_colouring.start[1], contact_colouring.sorted.count - contact_colouring.start[CONTACT_COLOURS]);
+            }
+            if (solver_mode == SOLVER_ISLANDS) print_island_stats(&islands);
+            printf("Uniform radius kernels: %s, uniform mass kernels: %s\n", uniform_radius ? "on" : "off", uniform_mass ? "on" : "off");
+            if (fixed_mode) printf("Fixed-point world: %d contacts\n", fixed_contacts.count);
+            if (large_world) printf("Large world: view at (%.1f, %.1f), %d occupied cells\n",
+                                    camera_tile_x * (double)WORLD_TILE_SIZE + camera_x, camera_tile_y * (double)WORLD_TILE_SIZE + camera_y, world_cells.count);
+        }
+        else if (event->key.key == SDLK_V){
+            solver_mode = (solver_mode + 1) % SOLVER_COUNT;
+            printf("Contact solver: %s\n", solver_mode_name(solver_mode));
+        }
+        else if (event->key.key == SDLK_F){
+            if (!fixed_mode) set_large_world(0);
+            fixed_mode = !fixed_mode;
+            fixed_balls.count = 0;
+            printf("Fixed-point world: %s\n", fixed_mode ? "on" : "off");
+        }
+        else if (event->key.key == SDLK_L){
+            set_large_world(!large_world);
+            printf("Large world: %s\n", large_world ? "on" : "off");
+        }
+        else if (large_world && (event->key.key == SDLK_W || event->key.key == SDLK_A || event->key.key == SDLK_S || event->key.key == SDLK_D)){
+            float step_x = WINDOW_WIDTH / 2.0f;
+            float step_y = WINDOW_HEIGHT / 2.0f;
+            if (event->key.key == SDLK_W) pan_camera(0, -step_y);
+            if (event->key.key == SDLK_A) pan_camera(-step_x, 0);
+            if (event->key.key == SDLK_S) pan_camera(0, step_y);
+            if (event->key.key == SDLK_D) pan_camera(step_x, 0);
+        }
+        else if (event->key.key == SDLK_T){
+            int cores = SDL_GetNumLogicalCPUCores();
+            int next = pool.worker_count >= cores ? 1 : pool.worker_count * 2 < cores ? pool.worker_count * 2 : cores;
+            pool_start(next);
+            printf("Worker threads: %d\n", pool.worker_count);
+        }
+        else if (event->key.key == SDLK_R){
+            reorder_interval = reorder_interval == 0 ? 64 : reorder_interval < 1024 ? reorder_interval * 4 : 0;
+            reorder_step = 0;
+            printf("Reorder interval: %d steps\n", reorder_interval);
+        }
+        else if (event->key.key == SDLK_P){
+            if (spawn_radius_max > spawn_radius_min){
+                spawn_radius_min = spawn_radius_max = 25.0f;
+            } else {
+                spawn_radius_min = 1.0f;
+                spawn_radius_max = 200.0f;
+            }
+            printf("Spawn radius: %.0f to %.0f\n", spawn_radius_min, spawn_radius_max);
+        }
+        else if (event->key.key == SDLK_BACKSPACE){
+            if (ball_count >= 10) {
+                remove_balls(10);
+                printf("Ball removed. Total balls: %d\n", ball_count);
+            }
+        }
+    }
+}
+
+// Steps as often as it can, up to once per SIMULATION_MIN_STEP, with the
+// time since the last step capped at 1/60 s as the old frame loop did. The
+// pool is only ever driven from here.
+int simulation_main(void *data){
+    Simulation *sim = data;
+    SDL_Event event;
+    Uint64 freq = SDL_GetPerformanceFrequency();
+    Uint64 prev = SDL_GetPerformanceCounter();
+
+    while (!SDL_GetAtomicInt(&sim->quit)){
+        while (event_queue_pop(&sim->events, &event)) handle_event(&event);
+
+        Uint64 now = SDL_GetPerformanceCounter();
+        double dt = (double)(now - prev) / (double)freq;
+        if (dt < SIMULATION_MIN_STEP){
+            SDL_DelayNS((Uint64)((SIMULATION_MIN_STEP - dt) * 1e9));
+            continue;
+        }
+        prev = now;
+        if (dt > 1.0/60.0) dt = 1.0/60.0;
+
+        update_balls(dt * simulation_speed);
+        publish_snapshot(sim);
     }
+    return 0;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     SDL_Window* window = NULL;
     SDL_Renderer* renderer = NULL;
 
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--bench") == 0) return run_kernel_benchmark();
+        if (strcmp(argv[i], "--bench-threads") == 0) return run_scaling_benchmark();
+    }
+
     int result1 = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
     if (result1 < 0) {
         SDL_Log("SDL_Init error: %s", SDL_GetError());
@@ -200,65 +4642,57 @@ int main() {
 
     SDL_Log("SDL3 Initialized");
 
+    select_kernels();
+    SDL_Log("Simulation kernels: %s", kernels.name);
+
+    int worker_count = 0;
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--reserve") == 0 && i + 1 < argc){
+            if (reserve_balls(atoi(argv[++i]))) SDL_Log("Reserved storage for %d balls", ball_capacity);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+            worker_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--solver") == 0 && i + 1 < argc){
+            const char *name = argv[++i];
+            for (int mode = 0; mode < SOLVER_COUNT; mode++){
+                if (strcmp(name, solver_mode_name(mode)) == 0) solver_mode = mode;
+            }
+        }
+    }
+    pool_start(worker_count);
+    SDL_Log("Worker threads: %d", pool.worker_count);
+    SDL_Log("Contact solver: %s", solver_mode_name(solver_mode));
+
+    SDL_SetAtomicInt(&simulation.shared, 1);
+    simulation.thread = SDL_CreateThread(simulation_main, "simulation", &simulation);
+    if (simulation.thread == NULL){
+        SDL_Log("SDL_CreateThread: %s", SDL_GetError());
+        return -5;
+    }
+
     SDL_Event event;
     int quit = 0;
 
-    Uint64 freq = SDL_GetPerformanceFrequency();
-    Uint64 prev = SDL_GetPerformanceCounter();
-    float simulation_speed = 1.0f;
-
     while (!quit) {
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_EVENT_QUIT) quit = 1;
-            else if (event.type == SDL_EVENT_MOUSE_BUTTON_DOWN && ball_count < MAX_BALLS){
-                float mx, my;
-                SDL_GetMouseState(&mx, &my);
-                for (int i = 0; i < 10; i++){
-                    spawn_ball((float)mx, (float)my);
-                }
-                printf("%d ", ball_count);
-            } 
-            else if (event.type == SDL_EVENT_WINDOW_RESIZED){
-                int width, height;
-                SDL_GetWindowSize(window, &width, &height);
-                WINDOW_WIDTH = width;
-                WINDOW_HEIGHT = height;
-            }
-            else if (event.type == SDL_EVENT_KEY_DOWN) {
-                if (event.key.key == SDLK_UP) {
-                    simulation_speed += 0.5f;
-                    printf("Simulation speed: %.2f\n", simulation_speed);
-                } 
-            else if (event.key.key == SDLK_DOWN) {
-                if (simulation_speed > 0.0f){
-                    simulation_speed -= 0.5f;
-                    printf("Simulation speed: %.2f\n", simulation_speed);
-                }
-            }
-            else if (event.key.key == SDLK_BACKSPACE){
-                if (ball_count >= 10) {
-                    ball_count-=10;
-                    printf("Ball removed. Total balls: %d\n", ball_count);
-                }
+            else if (event.type == SDL_EVENT_MOUSE_BUTTON_DOWN || event.type == SDL_EVENT_WINDOW_RESIZED || event.type == SDL_EVENT_KEY_DOWN){
+                if (!event_queue_push(&simulation.events, &event)) SDL_Log("Input queue full, event dropped");
             }
         }
-    }
-
-        Uint64 now = SDL_GetPerformanceCounter();
-        double dt = (double)(now - prev) / (double)freq;
-        prev = now;
-        if (dt > 1.0/60.0) dt = 1.0/60.0;
-
-        update_balls(dt * simulation_speed);
 
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
         SDL_RenderClear(renderer);
 
-        render_balls(renderer);        
+        render_snapshot(renderer, latest_snapshot(&simulation));
 
         SDL_RenderPresent(renderer);
     }
 
+    SDL_SetAtomicInt(&simulation.quit, 1);
+    SDL_WaitThread(simulation.thread, NULL);
+    pool_stop();
     SDL_Log("SDL3 shutdown");
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);